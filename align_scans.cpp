@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <tuple>
+#include <vector>
+#include "lego_robot.h"
+#include "lego_log_cache.h"
+#include "lego_log_writer.h"
+#include "lego_motion_model.h"
+#include "lego_time_align.h"
+
+// Pairs every scan with the odometry pose at the scan's time and writes
+// the poses to scan_poses.txt, one F record per scan. Our logger writes an
+// M and an S record with the same timestamp, so each such scan must get
+// exactly the pose of its M record (the start pose for the first one);
+// the tool checks this and fails if it does not hold.
+
+int main() {
+	LegoLogfile logfile;
+	LogCache::read(logfile, "robot4_motors.txt", RecordSet("M"));
+	LogCache::read(logfile, "robot4_scan.txt", RecordSet("S"));
+
+	// Empirically derived values, as in filter_motor_to_file.
+	MotionModel<double, ScannerOffset<double>> model(0.349, 150.0, ScannerOffset<double>(30.0));
+	const std::tuple<double, double, double> start(1850.0, 1897.0, 213.0 / 180.0 * M_PI);
+
+	std::vector<std::tuple<double, double, double>> poses;
+	std::tuple<double, double, double> pose = start;
+	for (const auto& ticks : logfile.motor_ticks) {
+		pose = model.step(pose, std::make_pair(std::get<0>(ticks), std::get<1>(ticks)));
+		poses.push_back(pose);
+	}
+	auto scan_poses = align_scans_to_odometry(logfile, start, poses);
+
+	LegoLogWriter out_file("scan_poses.txt");
+	for (const auto& p : scan_poses) out_file.filtered_position(std::get<0>(p), std::get<1>(p), std::get<2>(p));
+	out_file.close();
+
+	// Scans at the time of an M record.
+	size_t same_time = 0, mismatches = 0;
+	for (size_t i = 0; i < scan_poses.size(); ++i) {
+		int t = logfile.scan_timestamps[i];
+		const std::tuple<double, double, double>* expected = nullptr;
+		if (t == logfile.motor_start_timestamp) {
+			expected = &start;
+		} else {
+			auto it = std::lower_bound(logfile.motor_timestamps.begin(), logfile.motor_timestamps.end(), t);
+			if (it != logfile.motor_timestamps.end() && *it == t) expected = &poses[it - logfile.motor_timestamps.begin()];
+		}
+		if (expected == nullptr) continue;
+		++same_time;
+		if (scan_poses[i] != *expected) ++mismatches;
+	}
+	std::cout << scan_poses.size() << " scans aligned, " << same_time << " at the time of an M record, "
+	          << mismatches << " of them off its pose" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
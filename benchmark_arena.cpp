@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <sys/resource.h>
+#include "lego_robot.h"
+
+// Allocation count, time and peak memory of loading a log into a
+// LegoLogfile and destroying it, with the lists on the global heap or in
+// a monotonic arena. Peak RSS is per process, so run each mode separately:
+// Usage: benchmark_arena [logfile] [heap|arena]
+
+// Counts all calls of the global operator new and delete, including the
+// aligned ones std::pmr::new_delete_resource() uses.
+static size_t s_allocations = 0;
+static size_t s_deallocations = 0;
+
+[[gnu::noinline]] void* operator new(std::size_t size) {
+	++s_allocations;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t alignment) {
+	++s_allocations;
+	size_t a = std::max(static_cast<size_t>(alignment), sizeof(void*));
+	if (void* p = std::aligned_alloc(a, (size + a - 1) / a * a)) return p;
+	throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+	if (p) ++s_deallocations;
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete(void* p, std::align_val_t) noexcept { operator delete(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { operator delete(p); }
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_scan.txt";
+	bool arena = argc > 2 && std::string(argv[2]) == "arena";
+
+	size_t load_allocations, frees;
+	double t_load, t_free;
+	size_t records;
+	std::string footprint;
+	{
+		std::pmr::monotonic_buffer_resource resource(1 << 20);
+		std::pmr::memory_resource* memory = arena ? &resource : std::pmr::get_default_resource();
+
+		size_t before = s_allocations;
+		auto start = std::chrono::steady_clock::now();
+		auto* logfile = new LegoLogfile(memory);
+		logfile->read_mapped(filename);
+		t_load = seconds_since(start);
+		load_allocations = s_allocations - before;
+		records = logfile->size();
+		footprint = logfile->info();
+
+		// With the arena, the lists give nothing back; the arena goes in one
+		// piece when it goes out of scope, which is part of the teardown.
+		before = s_deallocations;
+		start = std::chrono::steady_clock::now();
+		delete logfile;
+		resource.release();
+		t_free = seconds_since(start);
+		frees = s_deallocations - before;
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << filename << " (" << records << " records), " << (arena ? "arena" : "heap") << ":\n";
+	std::cout << "load     " << std::setw(10) << load_allocations << " allocations " << std::setw(8) << t_load * 1000.0 << " ms\n";
+	std::cout << "teardown " << std::setw(10) << frees << " frees       " << std::setw(8) << t_free * 1000.0 << " ms\n";
+	std::cout << "peak RSS " << std::setw(10) << usage.ru_maxrss / 1024.0 << " MB\n";
+	std::cout << footprint;
+	return 0;
+}
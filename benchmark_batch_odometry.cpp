@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "lego_robot.h"
+#include "lego_batch_odometry.h"
+#include "lego_motion_model.h"
+
+// Integrates the tick stream of a motor log through many calibration
+// candidates (ticks_to_mm and robot_width around the measured values), with
+// the batch kernel and with MotionModel one hypothesis at a time, and
+// reports pose updates per second and the largest difference between both.
+// Build with -march=native (or -mavx2 -mfma) to get the vector kernel.
+// Usage: benchmark_batch_odometry [motor log] [hypotheses]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_motors.txt";
+	size_t hypotheses = argc > 2 ? std::stoul(argv[2]) : 4096;
+
+	LegoLogfile logfile;
+	logfile.read_mapped(filename, RecordSet("M"));
+	std::vector<int> left, right;
+	for (const auto& t : logfile.motor_ticks) {
+		left.push_back(std::get<0>(t));
+		right.push_back(std::get<1>(t));
+	}
+	if (left.empty()) {
+		std::cerr << "No motor ticks in " << filename << std::endl;
+		return 1;
+	}
+
+	// Empirically derived values, as in filter_motor_to_file.
+	const double scanner_displacement = 30.0;
+	const MotionModel<double>::Pose start(1850.0, 1897.0, 213.0 / 180.0 * M_PI);
+	PoseBatch batch;
+	batch.assign(hypotheses, start, 0.349, 150.0);
+	for (size_t i = 0; i < hypotheses; ++i) {
+		batch.ticks_to_mm[i] = 0.33 + 0.04 * static_cast<double>(i % 64) / 63.0;
+		batch.robot_width[i] = 140.0 + 20.0 * static_cast<double>(i / 64 % 64) / 63.0;
+	}
+	PoseBatch reference = batch;
+
+	auto t = std::chrono::steady_clock::now();
+	for (size_t k = 0; k < left.size(); ++k) batch_step(batch, left[k], right[k], scanner_displacement);
+	double t_batch = seconds_since(t);
+
+	t = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < hypotheses; ++i) {
+		MotionModel<double, ScannerOffset<double>> model(reference.ticks_to_mm[i], reference.robot_width[i],
+		                                                 ScannerOffset<double>(scanner_displacement));
+		MotionModel<double>::Pose pose = reference.pose(i);
+		for (size_t k = 0; k < left.size(); ++k) pose = model.step(pose, std::make_pair(left[k], right[k]));
+		std::tie(reference.x[i], reference.y[i], reference.theta[i]) = pose;
+	}
+	double t_scalar = seconds_since(t);
+
+	double max_position = 0.0, max_heading = 0.0;
+	for (size_t i = 0; i < hypotheses; ++i) {
+		max_position = std::max(max_position, std::hypot(batch.x[i] - reference.x[i], batch.y[i] - reference.y[i]));
+		max_heading = std::max(max_heading, std::abs(std::remainder(batch.theta[i] - reference.theta[i], 2 * M_PI)));
+	}
+
+	double updates = static_cast<double>(hypotheses) * static_cast<double>(left.size());
+	std::cout << filename << ": " << left.size() << " steps, " << hypotheses << " hypotheses\n";
+	std::cout << std::scientific << std::setprecision(2);
+	std::cout << "batch (" << batch_odometry_isa() << ")  " << updates / t_batch << " pose updates/s\n";
+	std::cout << "MotionModel     " << updates / t_scalar << " pose updates/s\n";
+	std::cout << "largest difference " << max_position << " mm, " << max_heading << " rad\n";
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "lego_robot.h"
+#include "lego_log_dataset.h"
+
+// Writes a log as a dataset of small segments and reads it back with
+// LegoDataset::read() and read_time(): every S and M record in windows of
+// a few records, and time windows over the S and M timestamps. Fails if a
+// window differs from the same slice of the log read in one piece, and
+// reports the time per query and how many segments the queries opened.
+// Usage: benchmark_dataset [logfile] [records per segment] [dataset directory]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Records first .. first + count - 1 of type in log, as LegoDataset::read()
+// would give them.
+static bool same_slice(const LegoLogfile& part, const LegoLogfile& log, char type, size_t first, size_t count) {
+	if (type == 'S') {
+		if (part.scan_data.size() != count || part.scan_timestamps.size() != count) return false;
+		for (size_t i = 0; i < count; ++i) {
+			if (part.scan_timestamps[i] != log.scan_timestamps[first + i]) return false;
+			if (!std::equal(part.scan_data[i].begin(), part.scan_data[i].end(), log.scan_data[first + i].begin(),
+			                log.scan_data[first + i].end())) return false;
+		}
+		return true;
+	}
+	if (part.motor_ticks.size() != count || part.motor_timestamps.size() != count) return false;
+	for (size_t i = 0; i < count; ++i) {
+		if (part.motor_ticks[i] != log.motor_ticks[first + i]) return false;
+		if (part.motor_timestamps[i] != log.motor_timestamps[first + i]) return false;
+	}
+	int start = first == 0 ? log.motor_start_timestamp : log.motor_timestamps[first - 1];
+	return count == 0 || part.motor_start_timestamp == start;
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_scan.txt";
+	size_t records_per_segment = argc > 2 ? std::stoul(argv[2]) : 32;
+	std::string directory = argc > 3 ? argv[3] : filename + ".dataset";
+
+	LegoLogfile log;
+	log.read_mapped(filename);
+	if (!LegoDataset::write(log, directory, records_per_segment)) {
+		std::cerr << "Unable to write " << directory << std::endl;
+		return 1;
+	}
+	LegoDataset dataset;
+	if (!dataset.open(directory)) {
+		std::cerr << "Unable to open " << directory << std::endl;
+		return 1;
+	}
+	std::cout << filename << ": " << dataset.segment_count() << " segments of " << records_per_segment
+	          << " records in " << directory << "\n";
+
+	bool ok = true;
+	for (char type : {'S', 'M'}) {
+		const std::vector<int> times = type == 'S' ? std::vector<int>(log.scan_timestamps.begin(), log.scan_timestamps.end())
+		                                           : std::vector<int>(log.motor_timestamps.begin(), log.motor_timestamps.end());
+		size_t records = times.size();
+		if (dataset.count(type) != records) {
+			std::cerr << type << ": dataset has " << dataset.count(type) << " records, the log " << records << std::endl;
+			ok = false;
+			continue;
+		}
+
+		// Windows which start and end anywhere within the segments.
+		const size_t window = records_per_segment / 2 + 3;
+		size_t queries = 0, opened = dataset.segments_opened();
+		auto t = std::chrono::steady_clock::now();
+		for (size_t first = 0; first < records; first += window / 2 + 1, ++queries) {
+			size_t count = std::min(window, records - first);
+			LegoLogfile part;
+			if (!dataset.read(part, type, first, count) || !same_slice(part, log, type, first, count)) {
+				std::cerr << type << ": read(" << first << ", " << count << ") differs from the log" << std::endl;
+				ok = false;
+				break;
+			}
+		}
+		double t_read = seconds_since(t);
+		size_t read_opened = dataset.segments_opened() - opened;
+
+		// Time windows between the timestamps of the records.
+		size_t time_queries = 0;
+		opened = dataset.segments_opened();
+		t = std::chrono::steady_clock::now();
+		for (size_t first = 0; first < records; first += window, ++time_queries) {
+			size_t last = std::min(records, first + window) - 1;
+			LegoLogfile part;
+			size_t n = dataset.read_time(part, type, times[first], times[last]);
+			size_t begin = std::lower_bound(times.begin(), times.end(), times[first]) - times.begin();
+			size_t end = std::upper_bound(times.begin(), times.end(), times[last]) - times.begin();
+			if (n != end - begin || !same_slice(part, log, type, begin, end - begin)) {
+				std::cerr << type << ": read_time(" << times[first] << ", " << times[last] << ") differs from the log"
+				          << std::endl;
+				ok = false;
+				break;
+			}
+		}
+		double t_time = seconds_since(t);
+		size_t time_opened = dataset.segments_opened() - opened;
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << type << " read()      " << std::setw(8) << t_read * 1000.0 / std::max<size_t>(queries, 1)
+		          << " ms per query, " << queries << " queries opened " << read_opened << " segments\n";
+		std::cout << type << " read_time() " << std::setw(8) << t_time * 1000.0 / std::max<size_t>(time_queries, 1)
+		          << " ms per query, " << time_queries << " queries opened " << time_opened << " segments\n";
+	}
+	std::cout << (ok ? "all queries match the log" : "MISMATCH") << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "lego_robot.h"
+#include "lego_dead_reckoning.h"
+#include "lego_motion_model.h"
+
+// Time of integrating a long tick sequence with the serial pose loop of
+// filter_motor_to_file and with the parallel prefix scan of
+// lego_dead_reckoning.h, and the largest difference between both. The
+// ticks of the motor log are repeated to the requested number of steps.
+// Usage: benchmark_dead_reckoning [motor log] [steps] [threads]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_motors.txt";
+	size_t steps = argc > 2 ? std::stoul(argv[2]) : 1000000;
+	unsigned threads = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 0;
+
+	LegoLogfile logfile;
+	logfile.read_mapped(filename, RecordSet("M"));
+	if (logfile.motor_ticks.empty()) {
+		std::cerr << "No motor ticks in " << filename << std::endl;
+		return 1;
+	}
+	std::vector<std::pair<int, int>> ticks;
+	ticks.reserve(steps);
+	for (size_t i = 0; i < steps; ++i) {
+		const auto& t = logfile.motor_ticks[i % logfile.motor_ticks.size()];
+		ticks.emplace_back(std::get<0>(t), std::get<1>(t));
+	}
+
+	// As in filter_motor_to_file.
+	MotionModel<double, ScannerOffset<double>> model(0.349, 150.0, ScannerOffset<double>(30.0));
+	const std::tuple<double, double, double> start(1850.0, 1897.0, 213.0 / 180.0 * M_PI);
+
+	auto t = std::chrono::steady_clock::now();
+	std::vector<std::tuple<double, double, double>> serial(ticks.size());
+	std::tuple<double, double, double> pose = start;
+	for (size_t i = 0; i < ticks.size(); ++i) serial[i] = pose = model.step(pose, ticks[i]);
+	double t_serial = seconds_since(t);
+
+	t = std::chrono::steady_clock::now();
+	auto one = dead_reckoning(model, start, ticks, 1);
+	double t_one = seconds_since(t);
+
+	t = std::chrono::steady_clock::now();
+	auto scanned = dead_reckoning(model, start, ticks, threads);
+	double t_scan = seconds_since(t);
+
+	double distance = 0.0, max_position = 0.0, max_heading = 0.0;
+	for (size_t i = 0; i < ticks.size(); ++i) {
+		distance += 0.349 * std::abs(ticks[i].first + ticks[i].second) / 2.0;
+		max_position = std::max(max_position, std::hypot(std::get<0>(scanned[i]) - std::get<0>(serial[i]),
+		                                                 std::get<1>(scanned[i]) - std::get<1>(serial[i])));
+		max_heading = std::max(max_heading, std::abs(std::remainder(std::get<2>(scanned[i]) - std::get<2>(serial[i]), 2 * M_PI)));
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << filename << ": " << ticks.size() << " steps, " << distance / 1e6 << " km\n";
+	std::cout << "serial loop     " << std::setw(8) << t_serial * 1000.0 << " ms\n";
+	std::cout << "scan, 1 thread  " << std::setw(8) << t_one * 1000.0 << " ms\n";
+	std::cout << "scan, " << (threads ? threads : default_thread_count()) << " threads " << std::setw(8) << t_scan * 1000.0
+	          << " ms  (x" << t_serial / t_scan << ")\n";
+	std::cout << std::scientific << std::setprecision(2);
+	std::cout << "largest difference " << max_position << " mm, " << max_heading << " rad\n";
+	return 0;
+}
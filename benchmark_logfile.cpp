@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sys/stat.h>
+#include "lego_robot.h"
+#include "lego_log_binary.h"
+#include "lego_log_cache.h"
+#include "lego_log_index.h"
+#include "lego_log_stream.h"
+#include "lego_log_writer.h"
+#include "lego_scan_codec.h"
+
+// Compares the throughput of the LegoLogfile parsers on one log file.
+// Usage: benchmark_logfile [logfile] [repetitions]
+
+template <typename ReadFunction>
+double best_seconds(int repetitions, ReadFunction read) {
+	// Run the read a few times and keep the fastest, to hide cold caches.
+	double best = 1e30;
+	for (int r = 0; r < repetitions; ++r) {
+		auto start = std::chrono::steady_clock::now();
+		read();
+		auto stop = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double>(stop - start).count());
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_scan.txt";
+	int repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) {
+		std::cerr << "Unable to open " << filename << std::endl;
+		return 1;
+	}
+	double megabytes = st.st_size / (1024.0 * 1024.0);
+
+	LegoLogfile reference, mapped;
+	double t_stream = best_seconds(repetitions, [&] { reference = LegoLogfile(); reference.read(filename); });
+	double t_mapped = best_seconds(repetitions, [&] { mapped = LegoLogfile(); mapped.read_mapped(filename); });
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << filename << ": " << megabytes << " MB, " << reference.size() << " records\n";
+	std::cout << "read()        " << std::setw(8) << megabytes / t_stream << " MB/s\n";
+	std::cout << "read_mapped() " << std::setw(8) << megabytes / t_mapped << " MB/s"
+	          << "  (x" << t_stream / t_mapped << ")\n";
+
+	if (reference != mapped) {
+		std::cerr << "read_mapped() result differs from read()" << std::endl;
+		return 1;
+	}
+
+	LegoLogfile parallel;
+	double t_parallel = best_seconds(repetitions, [&] { parallel = LegoLogfile(); parallel.read_parallel(filename); });
+	std::cout << "read_parallel()" << std::setw(7) << megabytes / t_parallel << " MB/s"
+	          << "  (x" << t_stream / t_parallel << ", " << default_thread_count() << " threads)\n";
+	if (reference != parallel) {
+		std::cerr << "read_parallel() result differs from read()" << std::endl;
+		return 1;
+	}
+
+	// The robust parser does the same work, plus counting.
+	LegoLogfile robust;
+	ParseStats stats;
+	double t_robust = best_seconds(repetitions, [&] { robust = LegoLogfile(); stats = robust.read_robust(filename); });
+	std::cout << "read_robust() " << std::setw(8) << megabytes / t_robust << " MB/s"
+	          << "  (" << stats.rejected_lines << " rejected, " << stats.blank_lines << " blank lines)\n";
+	if (stats.rejected_lines == 0 && stats.blank_lines == 0 && reference != robust) {
+		std::cerr << "read_robust() result differs from read()" << std::endl;
+		return 1;
+	}
+
+	// A pass that only needs the motor ticks skips all other lines.
+	LegoLogfile motors_only;
+	double t_motors = best_seconds(repetitions, [&] { motors_only = LegoLogfile(); motors_only.read_mapped(filename, RecordSet("M")); });
+	std::cout << "M records only" << std::setw(8) << megabytes / t_motors << " MB/s"
+	          << "  (x" << t_mapped / t_motors << " over read_mapped())\n";
+	if (reference.motor_ticks != motors_only.motor_ticks) {
+		std::cerr << "read_mapped(\"M\") motor ticks differ from read()" << std::endl;
+		return 1;
+	}
+
+	// Write everything back as text, and check that it reads back the same.
+	std::string text_filename = filename + ".bench.txt";
+	double t_write = best_seconds(repetitions, [&] {
+		LegoLogWriter writer(text_filename);
+		writer.set_precision(0);
+		writer.write(reference);
+	});
+	struct stat written;
+	stat(text_filename.c_str(), &written);
+	std::cout << "LegoLogWriter " << std::setw(8) << written.st_size / (1024.0 * 1024.0) / t_write << " MB/s written\n";
+	LegoLogfile reread;
+	reread.read_mapped(text_filename);
+	std::remove(text_filename.c_str());
+	if (reference != reread) {
+		std::cerr << "LegoLogWriter output does not read back the same" << std::endl;
+		return 1;
+	}
+
+	// Running tick sums going backwards through -1 (the robot backing up)
+	// must read back the same with every parser.
+	LegoLogfile backwards;
+	for (int i = 0; i < 8; ++i) {
+		backwards.motor_ticks.emplace_back(i < 4 ? -1 : 1, i < 4 ? -1 : 2);
+		backwards.motor_timestamps.push_back(100 * (i + 1));
+	}
+	std::string backwards_filename = filename + ".bench.m.txt";
+	{
+		LegoLogWriter writer(backwards_filename);
+		writer.write(backwards);
+	}
+	LegoLogfile backwards_read, backwards_mapped, backwards_parallel, backwards_streamed;
+	backwards_read.read(backwards_filename);
+	backwards_mapped.read_mapped(backwards_filename);
+	backwards_parallel.read_parallel(backwards_filename, 3);
+	LegoLogReader backwards_reader(backwards_filename);
+	backwards_reader.for_each([&](const LogRecord& record) {
+		backwards_streamed.motor_ticks.push_back(record.motor_ticks);
+		backwards_streamed.motor_timestamps.push_back(record.timestamp);
+	});
+	std::remove(backwards_filename.c_str());
+	for (const LegoLogfile* log : {&backwards_read, &backwards_mapped, &backwards_parallel, &backwards_streamed}) {
+		if (*log != backwards) {
+			std::cerr << "Motor ticks through -1 do not read back the same" << std::endl;
+			return 1;
+		}
+	}
+
+	// Lines with too few fields are skipped by every parser, and not
+	// counted by the index. The first line is short, so it must not replace
+	// the P records before it either; the unpaired 3 of the D line is dropped.
+	std::string short_filename = filename + ".bench.short.txt";
+	{
+		std::ofstream out(short_filename);
+		out << "P 100 5\nP 100 5 6\nS 110 3 1 2 3\nM 120 10 0 0 0 20\nI 130\nI\nM 140 11\n"
+		       "M 150 12 0 0 0 22\nS\nF 1.5\nF 1.5 2.5\nL C 1 2\nL C 1 2 3\nD 160 1 2 3\nS 170 2 4 5\n";
+	}
+	LegoLogfile short_read, short_mapped, short_parallel;
+	short_read.read(short_filename);
+	short_mapped.read_mapped(short_filename);
+	short_parallel.read_parallel(short_filename, 3);
+	std::string short_types;
+	std::vector<std::vector<int>> short_scans;
+	LegoLogReader short_reader(short_filename);
+	short_reader.for_each([&](const LogRecord& record) {
+		short_types += record.type;
+		if (record.type == 'S') short_scans.emplace_back(record.scan.begin(), record.scan.end());
+	});
+	bool short_ok = short_read == short_mapped && short_read == short_parallel && short_types == "PSIMFLDS" &&
+	                short_scans.size() == short_read.scan_data.size();
+	for (size_t n = 0; short_ok && n < short_scans.size(); ++n) {
+		short_ok = std::equal(short_scans[n].begin(), short_scans[n].end(), short_read.scan_data[n].begin(),
+		                      short_read.scan_data[n].end());
+	}
+	{
+		IndexedLogfile indexed(short_filename);
+		for (const RecordFootprint& f : short_read.footprint()) {
+			size_t lines = f.type == 'M' ? f.records + 1 : f.records;
+			if (indexed.count(f.type) != lines) short_ok = false;
+		}
+		for (size_t n = 0; short_ok && n < short_read.scan_data.size(); ++n) {
+			std::vector<int> scan = indexed.scan(n);
+			short_ok = std::equal(scan.begin(), scan.end(), short_read.scan_data[n].begin(), short_read.scan_data[n].end());
+		}
+	}
+	std::remove(short_filename.c_str());
+	std::remove(LogIndex::sidecar_name(short_filename).c_str());
+	if (!short_ok) {
+		std::cerr << "Lines with too few fields do not read back the same" << std::endl;
+		return 1;
+	}
+
+	// Load time of the same data converted to the binary format.
+	std::string binary_filename = filename + ".bench.lgb";
+	if (!LegoLogBinary::write(reference, binary_filename)) {
+		std::cerr << "Unable to write " << binary_filename << std::endl;
+		return 1;
+	}
+	LegoLogfile binary;
+	double t_binary = best_seconds(repetitions, [&] { binary = LegoLogfile(); LegoLogBinary::read(binary, binary_filename); });
+	std::remove(binary_filename.c_str());
+	std::cout << "binary load   " << std::setw(8) << megabytes / t_binary << " MB/s"
+	          << "  (x" << t_stream / t_binary << ", " << t_binary * 1000.0 << " ms)\n";
+	if (reference != binary) {
+		std::cerr << "binary load result differs from read()" << std::endl;
+		return 1;
+	}
+
+	// Load time from the parsed-log cache, once it is warm.
+	LegoLogfile cached;
+	LogCache::read(cached, filename);
+	double t_cached = best_seconds(repetitions, [&] { cached = LegoLogfile(); LogCache::read(cached, filename); });
+	std::cout << "cached load   " << std::setw(8) << megabytes / t_cached << " MB/s"
+	          << "  (x" << t_stream / t_cached << ", " << t_cached * 1000.0 << " ms)\n";
+	if (reference != cached) {
+		std::cerr << "cached load result differs from read()" << std::endl;
+		return 1;
+	}
+
+	// Decode time of the compressed scans, against parsing only the S records.
+	if (!reference.scan_data.empty()) {
+		std::string codec_filename = filename + ".bench.lgs";
+		if (!LegoScanCodec::write(reference, codec_filename)) {
+			std::cerr << "Unable to write " << codec_filename << std::endl;
+			return 1;
+		}
+		struct stat codec;
+		stat(codec_filename.c_str(), &codec);
+		LegoLogfile scans_text, scans_codec;
+		double t_scans = best_seconds(repetitions, [&] { scans_text = LegoLogfile(); scans_text.read_mapped(filename, RecordSet("S")); });
+		double t_codec = best_seconds(repetitions, [&] { scans_codec = LegoLogfile(); LegoScanCodec::read(scans_codec, codec_filename); });
+		std::remove(codec_filename.c_str());
+		std::cout << "scan codec    " << std::setw(8) << t_codec * 1000.0 << " ms  (x" << t_scans / t_codec
+		          << " over S records only, " << codec.st_size / (1024.0 * 1024.0) << " MB)\n";
+		if (reference.scan_data != scans_codec.scan_data || reference.scan_timestamps != scans_codec.scan_timestamps) {
+			std::cerr << "scan codec result differs from read()" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "lego_robot.h"
+#include "lego_motion_model.h"
+#include "lego_particle_filter.h"
+
+// Predicts particles through the tick stream of a motor log, on one thread
+// and on a ThreadPool of `threads` threads (0 means one per core), and
+// reports the time per prediction step, whether both runs gave the same
+// particles bit for bit, and how far the particle mean ends up from the
+// noiseless MotionModel pose.
+// Usage: benchmark_particle_filter [motor log] [particles] [threads]
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_motors.txt";
+	size_t count = argc > 2 ? std::stoul(argv[2]) : 100000;
+	unsigned threads = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 0;
+
+	LegoLogfile logfile;
+	logfile.read_mapped(filename, RecordSet("M"));
+	if (logfile.motor_ticks.empty()) {
+		std::cerr << "No motor ticks in " << filename << std::endl;
+		return 1;
+	}
+
+	// Empirically derived values, as in filter_motor_to_file.
+	const double scanner_displacement = 30.0;
+	const MotionModel<double>::Pose start(1850.0, 1897.0, 213.0 / 180.0 * M_PI);
+	const uint64_t seed = 1;
+
+	PoseBatch one, many;
+	one.assign(count, start, 0.349, 150.0);
+	many = one;
+
+	ThreadPool one_thread(1);
+	ParticlePrediction predict_one(ControlNoise(), scanner_displacement, seed, one_thread);
+	auto t = std::chrono::steady_clock::now();
+	for (const auto& ticks : logfile.motor_ticks) predict_one(one, std::get<0>(ticks), std::get<1>(ticks));
+	double t_one = seconds_since(t);
+
+	ThreadPool pool(threads);
+	ParticlePrediction predict_many(ControlNoise(), scanner_displacement, seed, pool);
+	t = std::chrono::steady_clock::now();
+	for (const auto& ticks : logfile.motor_ticks) predict_many(many, std::get<0>(ticks), std::get<1>(ticks));
+	double t_many = seconds_since(t);
+
+	bool same = std::memcmp(one.x.data(), many.x.data(), count * sizeof(double)) == 0 &&
+	            std::memcmp(one.y.data(), many.y.data(), count * sizeof(double)) == 0 &&
+	            std::memcmp(one.theta.data(), many.theta.data(), count * sizeof(double)) == 0;
+
+	MotionModel<double, ScannerOffset<double>> model(0.349, 150.0, ScannerOffset<double>(scanner_displacement));
+	MotionModel<double>::Pose pose = start;
+	for (const auto& ticks : logfile.motor_ticks) pose = model.step(pose, std::make_pair(std::get<0>(ticks), std::get<1>(ticks)));
+	double mean_x = 0.0, mean_y = 0.0;
+	for (size_t i = 0; i < count; ++i) {
+		mean_x += many.x[i] / count;
+		mean_y += many.y[i] / count;
+	}
+
+	double steps = static_cast<double>(logfile.motor_ticks.size());
+	std::cout << filename << ": " << logfile.motor_ticks.size() << " steps, " << count << " particles\n";
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "1 thread    " << std::setw(8) << t_one * 1000.0 / steps << " ms per step\n";
+	std::cout << pool.size() << " threads   " << std::setw(8) << t_many * 1000.0 / steps
+	          << " ms per step  (x" << t_one / t_many << ")\n";
+	std::cout << "same particles: " << (same ? "yes" : "NO") << "\n";
+	std::cout << "particle mean " << std::hypot(mean_x - std::get<0>(pose), mean_y - std::get<1>(pose))
+	          << " mm from the noiseless pose\n";
+	return same ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sys/stat.h>
+#include "lego_robot.h"
+#include "lego_log_records.h"
+#include "lego_log_stream.h"
+
+// Parses a log with record types LegoLogfile does not know. Every M record
+// of the given log gets an IMU (U) and a battery (V) record with the same
+// timestamp, and every tenth a bumper (B) record; the result is written to
+// <logfile>.records and read back with ExtendedLogfile. Reports the
+// throughput against LegoLogfile on the same file, which skips the extra
+// records, and fails if the built-in lists differ between the two or the
+// extra records do not come back as written, by read_mapped() or by
+// BasicLegoLogReader.
+// Usage: benchmark_records [logfile] [repetitions]
+
+struct ImuRecord : LogRecordType<'U', int, float, float, float> {};  // timestamp, gyro z, accel x, y
+struct BatteryRecord : LogRecordType<'V', int, float> {};            // timestamp, volts
+struct BumperRecord : LogRecordType<'B', int, int> {};               // timestamp, pressed
+
+using RobotLogfile = ExtendedLogfile<ImuRecord, BatteryRecord, BumperRecord>;
+
+template <typename ReadFunction>
+double best_seconds(int repetitions, ReadFunction read) {
+	// Run the read a few times and keep the fastest, to hide cold caches.
+	double best = 1e30;
+	for (int r = 0; r < repetitions; ++r) {
+		auto start = std::chrono::steady_clock::now();
+		read();
+		auto stop = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double>(stop - start).count());
+	}
+	return best;
+}
+
+// The extra records written for the n-th M record.
+static ImuRecord::value_type imu_for(size_t n, int timestamp) {
+	return ImuRecord::value_type(timestamp, 0.25f * (n % 8), 0.5f * (n % 5), -0.125f * (n % 3));
+}
+
+static BatteryRecord::value_type battery_for(size_t n, int timestamp) {
+	return BatteryRecord::value_type(timestamp, 8.0f - 0.0625f * (n % 16));
+}
+
+int main(int argc, char** argv) {
+	std::string filename = argc > 1 ? argv[1] : "robot4_motors.txt";
+	int repetitions = argc > 2 ? std::stoi(argv[2]) : 3;
+	std::string records_filename = filename + ".records";
+
+	std::ifstream in(filename);
+	if (!in) {
+		std::cerr << "Unable to open " << filename << std::endl;
+		return 1;
+	}
+	std::ofstream out(records_filename);
+	size_t m_records = 0, bumper_records = 0;
+	std::string line;
+	while (std::getline(in, line)) {
+		out << line << "\n";
+		if (log_record_type(line.data(), line.data() + line.size()) != 'M') continue;
+		int timestamp = std::stoi(line.substr(line.find_first_not_of(" \t", 1)));
+		auto imu = imu_for(m_records, timestamp);
+		auto battery = battery_for(m_records, timestamp);
+		out << "U " << std::get<0>(imu) << " " << std::get<1>(imu) << " " << std::get<2>(imu) << " "
+		    << std::get<3>(imu) << "\n";
+		out << "V " << std::get<0>(battery) << " " << std::get<1>(battery) << "\n";
+		if (m_records % 10 == 0) {
+			out << "B " << timestamp << " " << (m_records / 10) % 2 << "\n";
+			++bumper_records;
+		}
+		++m_records;
+	}
+	out.close();
+
+	struct stat st;
+	stat(records_filename.c_str(), &st);
+	double megabytes = st.st_size / (1024.0 * 1024.0);
+
+	LegoLogfile plain;
+	RobotLogfile extended, streamed;
+	double t_plain = best_seconds(repetitions, [&] { plain = LegoLogfile(); plain.read_mapped(records_filename); });
+	double t_extended = best_seconds(repetitions, [&] { extended = RobotLogfile(); extended.read_mapped(records_filename); });
+	streamed.read(records_filename);
+	RobotLogfile robust;
+	ParseStats stats = robust.read_robust(records_filename);
+	std::vector<ImuRecord::value_type> streamed_imu;
+	size_t streamed_m_records = 0;
+	BasicLegoLogReader<RobotLogfile> reader(records_filename, RecordSet("MU"));
+	while (reader.next()) {
+		if (reader.record().type == 'U') streamed_imu.push_back(reader.value<ImuRecord>());
+		else ++streamed_m_records;
+	}
+	std::remove(records_filename.c_str());
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << records_filename << ": " << megabytes << " MB, " << m_records << " M records\n";
+	std::cout << "LegoLogfile    " << std::setw(8) << megabytes / t_plain << " MB/s\n";
+	std::cout << "ExtendedLogfile" << std::setw(8) << megabytes / t_extended << " MB/s"
+	          << "  (x" << t_plain / t_extended << ")\n";
+	std::cout << extended.info();
+
+	bool ok = true;
+	auto fail = [&](const char* what) {
+		std::cerr << what << std::endl;
+		ok = false;
+	};
+	if (extended.builtin() != plain) fail("built-in lists differ from LegoLogfile");
+	if (streamed != extended) fail("read() differs from read_mapped()");
+	if (robust != extended || stats.rejected_lines != 0 || stats.lines('U') != m_records) {
+		fail("read_robust() differs from read_mapped()");
+	}
+
+	const auto& extended_imu = extended.records<ImuRecord>();
+	if (!std::equal(streamed_imu.begin(), streamed_imu.end(), extended_imu.begin(), extended_imu.end()) ||
+	    streamed_m_records != extended.motor_ticks.size()) {
+		fail("BasicLegoLogReader differs from read_mapped()");
+	}
+
+	const auto& imu = extended.records<ImuRecord>();
+	const auto& battery = extended.records<BatteryRecord>();
+	const auto& bumper = extended.records<BumperRecord>();
+	if (imu.size() != m_records || battery.size() != m_records || bumper.size() != bumper_records) {
+		fail("extra record counts differ from what was written");
+	} else {
+		for (size_t n = 0; n < m_records; ++n) {
+			int timestamp = n == 0 ? extended.motor_start_timestamp : extended.motor_timestamps[n - 1];
+			if (imu[n] != imu_for(n, timestamp) || battery[n] != battery_for(n, timestamp)) {
+				fail("extra records differ from what was written");
+				break;
+			}
+		}
+	}
+	return ok ? 0 : 1;
+}
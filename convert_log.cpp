@@ -0,0 +1,73 @@
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "lego_robot.h"
+#include "lego_log_binary.h"
+#include "lego_log_dataset.h"
+#include "lego_log_npy.h"
+#include "lego_scan_codec.h"
+
+// Converts text logs to the binary columnar format of lego_log_binary.h,
+// or, for an output file ending in .lgs, their scans to the compressed
+// format of lego_scan_codec.h.
+// With --npy, the output is a directory of NumPy .npy files instead (see
+// lego_log_npy.h), and with --segments n a dataset directory of segments
+// of n records each (see lego_log_dataset.h).
+// Several input files are parsed concurrently and merged in order, as with
+// repeated read() calls.
+// Usage: convert_log [--compact] [--npy | --segments n] input.txt [input2.txt ...] output.lgb|output.lgs|directory
+
+int main(int argc, char** argv) {
+	LegoLogfile logfile;
+	bool npy = false;
+	size_t segment_records = 0;
+	std::vector<std::string> inputs;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--compact") {
+			// Store scans with 16 bit ranges.
+			logfile.compact_scans = true;
+		} else if (arg == "--npy") {
+			npy = true;
+		} else if (arg == "--segments" && i + 1 < argc) {
+			std::string count = argv[++i];
+			auto result = std::from_chars(count.data(), count.data() + count.size(), segment_records);
+			if (result.ec != std::errc() || result.ptr != count.data() + count.size() || segment_records == 0) {
+				std::cerr << "--segments needs a positive number of records, not \"" << count << "\"" << std::endl;
+				return 1;
+			}
+		} else {
+			inputs.push_back(arg);
+		}
+	}
+	if (inputs.size() < 2) {
+		std::cerr << "Usage: convert_log [--compact] [--npy | --segments n] input.txt [input2.txt ...] output.lgb|output.lgs|directory" << std::endl;
+		return 1;
+	}
+	std::string output = inputs.back();
+	inputs.pop_back();
+
+	// read_files() skips files it cannot open, which would quietly give a
+	// short output.
+	for (const std::string& input : inputs) {
+		if (!std::ifstream(input).is_open()) {
+			std::cerr << "Unable to open " << input << std::endl;
+			return 1;
+		}
+	}
+	logfile.read_files(inputs);
+
+	bool scans_only = output.size() > 4 && output.compare(output.size() - 4, 4, ".lgs") == 0;
+	bool written = npy ? LegoLogNpy::write(logfile, output)
+	             : segment_records > 0 ? LegoDataset::write(logfile, output, segment_records)
+	             : scans_only ? LegoScanCodec::write(logfile, output)
+	             : LegoLogBinary::write(logfile, output);
+	if (!written) {
+		std::cerr << "Unable to write " << output << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << logfile.size() << " records to " << output << std::endl;
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <vector>
 #include <cmath>
 #include "lego_robot.h"
+#include "lego_log_cache.h"
 #include "matplotlibcpp.h"
 
 namespace plt = matplotlibcpp;
@@ -58,7 +59,7 @@ int main() {
 
     // Read the logfile which contains all scans.
     LegoLogfile logfile;
-    logfile.read("robot4_scan.txt");
+    LogCache::read(logfile, "robot4_scan.txt", RecordSet("S"));
 
     // Pick one scan.
     std::vector<int> scan = logfile.scan_data[8];
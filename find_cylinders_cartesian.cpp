@@ -1,30 +1,36 @@
 #include "lego_robot.h" // Include the LegoLogfile class
+#include "lego_log_stream.h" // For reading the scans one by one
+#include "lego_log_writer.h" // For writing the cylinder records
+#include <chrono> // For the poll interval
 #include <cmath> // For sin, cos functions
-#include <fstream> // For file operations
 #include <iostream> // For standard I/O
+#include <string>
+#include <thread> // For sleeping between polls
 #include <vector> // For using the vector container
 #include "matplotlibcpp.h" // For plotting, ensure matplotlibcpp is correctly set up
 
 namespace plt = matplotlibcpp;
 
-std::vector<double> compute_derivative(const std::vector<double>& scan, double min_dist) {
+// The kernels take any indexable scan; the tool runs them on 16 bit ranges.
+template <typename Scan>
+void compute_derivative(const Scan& scan, double min_dist, std::vector<double>& jumps) {
 	// Find the derivative in scan data, ignoring invalid measurements.
-	std::vector<double> jumps(scan.size(), 0);
-	for (size_t i = 1; i < scan.size() - 1; ++i) {
+	// The result is written to jumps, whose storage is reused from scan to scan.
+	jumps.assign(scan.size(), 0);
+	for (size_t i = 1; i + 1 < scan.size(); ++i) {
 		double l = scan[i - 1];
 		double r = scan[i + 1];
 		if (l > min_dist && r > min_dist) {
 			jumps[i] = (r - l) / 2.0;
 		}
 	}
-
-	return jumps;
 }
 
-std::vector<std::pair<double, double>> find_cylinders(const std::vector<double>& scan, const std::vector<double>& scan_derivative, double jump, double min_dist) {
+template <typename Scan>
+void find_cylinders(const Scan& scan, const std::vector<double>& scan_derivative, double jump, double min_dist, std::vector<std::pair<double, double>>& cylinder_list) {
 	// For each area between a left falling edge and a right rising edge,
 	// determine the average ray number and the average depth.
-	std::vector<std::pair<double, double>> cylinder_list;
+	cylinder_list.clear();
 	bool on_cylinder = false;
 	double sum_ray = 0.0, sum_depth = 0.0;
 	int rays = 0;
@@ -51,48 +57,65 @@ std::vector<std::pair<double, double>> find_cylinders(const std::vector<double>&
 			on_cylinder = false;
 		}
 	}
-
-	return cylinder_list;
 }
 
-std::vector<std::pair<double, double>> compute_cartesian_coordinates(const std::vector<std::pair<double, double>>& cylinders, double cylinder_offset) {
+void compute_cartesian_coordinates(const std::vector<std::pair<double, double>>& cylinders, double cylinder_offset, std::vector<std::pair<double, double>>& result) {
 	// For each cylinder in the scan, find its cartesian coordinates,
 	// in the scanner's coordinate system.
-	std::vector<std::pair<double, double>> result;
+	result.clear();
 	for (const auto& c : cylinders) {
 		double angle = LegoLogfile::beam_index_to_angle(c.first);
 		double x = (c.second + cylinder_offset) * cos(angle);
 		double y = (c.second + cylinder_offset) * sin(angle);
 		result.push_back(std::make_pair(x, y));
 	}
-	return result;
 }
 
-int main() {
+int main(int argc, char** argv) {
+	// With --follow, keep detecting as the logger appends scans to the log.
+	bool follow = argc > 1 && std::string(argv[1]) == "--follow";
+
 	double minimum_valid_distance = 20.0;
 	double depth_jump = 100.0;
 	double cylinder_offset = 90.0;
 
-	// Read the logfile which contains all scans.
-	LegoLogfile logfile;
-	logfile.read("robot4_scan.txt");
-
 	// Write a result file containing all cylinder records.
-	std::ofstream out_file("cylinders-2.txt");
-	for (const auto& scan : logfile.scan_data) {
-		std::vector<double> scan_double(scan.begin(), scan.end());
+	// The scans are views into the reader's buffer, and the work vectors
+	// are reused, so the loop does not allocate once warmed up. The
+	// detector only needs the ranges, so they are read as 16 bit values.
+	LegoLogWriter out_file("cylinders-2.txt");
+	std::vector<double> der;
+	std::vector<std::pair<double, double>> cylinders, cartesian_cylinders;
+	auto process = [&](const LogRecord& record) {
+		const auto& scan = record.compact_scan;
 		// Find cylinders.
-		auto der = compute_derivative(scan_double, minimum_valid_distance);
-		auto cylinders = find_cylinders(scan_double, der, depth_jump, minimum_valid_distance);
-		auto cartesian_cylinders = compute_cartesian_coordinates(cylinders, cylinder_offset);
+		compute_derivative(scan, minimum_valid_distance, der);
+		find_cylinders(scan, der, depth_jump, minimum_valid_distance, cylinders);
+		compute_cartesian_coordinates(cylinders, cylinder_offset, cartesian_cylinders);
 
 		// Write to file.
-		out_file << "D C ";
-		for (const auto& c : cartesian_cylinders) {
-			out_file << c.first << " " << c.second << " ";
+		out_file.detected_cylinders(cartesian_cylinders);
+	};
+
+	if (follow) {
+		// Only the scans appended since the last poll are parsed. Runs
+		// until interrupted.
+		LegoLogFollower follower("robot4_scan.txt", RecordSet("S"));
+		follower.set_compact_scans(true);
+		for (;;) {
+			if (follower.poll(process) > 0) {
+				out_file.flush();
+			} else {
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
 		}
-		out_file << std::endl;
 	}
+
+	// Stream the scans of the logfile one at a time, so memory does not
+	// grow with the log length.
+	LegoLogReader reader("robot4_scan.txt", RecordSet("S"));
+	reader.set_compact_scans(true);
+	reader.for_each(process);
 	out_file.close();
 
 	return 0;
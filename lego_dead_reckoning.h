@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "lego_motion_model.h"
+#include "parallel_for.h"
+
+// All poses of a tick sequence at once, spread over several cores:
+//
+//     MotionModel<double, ScannerOffset<double>> model(0.349, 150.0, ScannerOffset<double>(30.0));
+//     auto poses = dead_reckoning(model, start, logfile.motor_ticks);
+//
+// poses[i] is the pose after motor_ticks[i], as in the loop
+// pose = model.step(pose, ticks). Each step is a rigid transform relative
+// to the pose before it (MotionModel::relative()), and the poses are the
+// prefix compositions of these transforms, computed as a parallel prefix
+// scan: every thread composes the transforms of its block from the
+// identity, the block starts follow serially from the block ends, and
+// every thread then moves its block to its start.
+//
+// Tolerance: the scan groups the floating point operations differently
+// from the serial loop, so the results differ by rounding, which grows with
+// the distance driven: for robot4_motors repeated by benchmark_dead_reckoning
+// up to 1e-6 mm and 2e-10 rad after 7 km, 4e-4 mm and 7e-8 rad after 70 km.
+// The heading agrees modulo 2 pi only. It is
+// std::fmod(sum of turns, 2 pi), whereas the loop wraps at every turn, so
+// the two can be 2 pi apart.
+
+// Pose a followed by b, with b given in the frame of a.
+template <typename Scalar>
+std::tuple<Scalar, Scalar, Scalar> compose_poses(const std::tuple<Scalar, Scalar, Scalar>& a,
+                                                 const std::tuple<Scalar, Scalar, Scalar>& b) {
+    Scalar c = std::cos(std::get<2>(a));
+    Scalar s = std::sin(std::get<2>(a));
+    return std::make_tuple(std::get<0>(a) + c * std::get<0>(b) - s * std::get<1>(b),
+                           std::get<1>(a) + s * std::get<0>(b) + c * std::get<1>(b),
+                           std::get<2>(a) + std::get<2>(b));
+}
+
+// Poses after each of motor_ticks (a list of (left, right) tuples or
+// pairs), starting at start, on up to `threads` threads (0 means one per
+// core).
+template <typename Scalar, typename Offset, typename Ticks>
+std::vector<std::tuple<Scalar, Scalar, Scalar>> dead_reckoning(const MotionModel<Scalar, Offset>& model,
+                                                               const std::tuple<Scalar, Scalar, Scalar>& start,
+                                                               const Ticks& motor_ticks, unsigned threads = 0) {
+    using Pose = std::tuple<Scalar, Scalar, Scalar>;
+    const size_t min_block = 4096; // Below this, threads cost more than they save
+    size_t n = motor_ticks.size();
+    std::vector<Pose> poses(n);
+    if (n == 0) return poses;
+    if (threads == 0) threads = default_thread_count();
+    size_t blocks = std::max<size_t>(1, std::min<size_t>(threads, n / min_block));
+    auto bound = [&](size_t b) { return n * b / blocks; };
+
+    // Each block from the identity.
+    parallel_for(blocks, threads, [&](size_t b) {
+        Pose p(Scalar(0), Scalar(0), Scalar(0));
+        for (size_t i = bound(b); i < bound(b + 1); ++i) {
+            const auto& t = motor_ticks[i];
+            p = compose_poses(p, model.relative(std::make_pair(static_cast<int>(std::get<0>(t)), static_cast<int>(std::get<1>(t)))));
+            poses[i] = p;
+        }
+    });
+
+    // Block starts, one after the other.
+    std::vector<Pose> origins(blocks);
+    origins[0] = start;
+    for (size_t b = 1; b < blocks; ++b) origins[b] = compose_poses(origins[b - 1], poses[bound(b) - 1]);
+
+    // Every block moved to its start, with the heading wrapped as
+    // MotionModel::step() does.
+    const Scalar twopi = 2 * MotionModel<Scalar, Offset>::pi;
+    parallel_for(blocks, threads, [&](size_t b) {
+        Scalar x0, y0, theta0;
+        std::tie(x0, y0, theta0) = origins[b];
+        Scalar c = std::cos(theta0);
+        Scalar s = std::sin(theta0);
+        for (size_t i = bound(b); i < bound(b + 1); ++i) {
+            Scalar x, y, theta;
+            std::tie(x, y, theta) = poses[i];
+            poses[i] = Pose(x0 + c * x - s * y, y0 + s * x + c * y, std::fmod(theta0 + theta, twopi));
+        }
+    });
+    return poses;
+}
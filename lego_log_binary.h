@@ -0,0 +1,505 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "lego_robot.h"
+#include "mapped_file.h"
+
+// Binary, columnar form of everything a LegoLogfile holds.
+// Produced once from the text logs (see convert_log.cpp), it loads without
+// any parsing: each list is one column that is copied in bulk out of the
+// memory-mapped file, so loading costs little more than paging it in.
+//
+// Layout (native byte order, i.e. little endian on our machines):
+//   BinaryLogHeader
+//   BinaryLogColumn[column_count]      the index of the columns
+//   column data, each column starting on a 64 byte boundary
+//
+// Bytes past header.file_size are not part of the log; a dataset segment
+// keeps its footer there (see lego_log_dataset.h).
+//
+// Variable length records (S, I, D) are stored as an offsets column of
+// rows + 1 entries and a values column, like a ScanStore.
+
+enum class BinaryColumnId : uint32_t {
+    ReferencePositions = 1,  // P: int32 x, y
+    ScanOffsets = 2,         // S: uint64
+    ScanRanges = 3,          // S: int32 or uint16 (compact scans)
+    PoleIndexOffsets = 4,    // I: uint64
+    PoleIndices = 5,         // I: int32
+    MotorTicks = 6,          // M: int32 left, right (differences)
+    FilteredPositions = 7,   // F: float x, y, heading
+    LandmarkTypes = 8,       // L: char
+    Landmarks = 9,           // L: float x, y, diameter
+    DetectedOffsets = 10,    // D: uint64
+    DetectedCylinders = 11,  // D: float x, y
+    MotorTimestamps = 12,    // M: int32, one per tick difference
+    ScanTimestamps = 13,     // S: int32
+    MotorStartTimestamp = 14 // M: int32, one row (of the first M record)
+};
+
+enum class BinaryElementType : uint32_t { Char = 1, UInt16 = 2, Int32 = 3, UInt64 = 4, Float32 = 5 };
+
+struct BinaryLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t column_count;
+    uint64_t file_size;
+};
+
+struct BinaryLogColumn {
+    uint32_t id;      // BinaryColumnId
+    uint32_t type;    // BinaryElementType
+    uint32_t width;   // Values per row
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t offset;  // From the start of the file
+};
+
+static const char binary_log_magic[8] = {'L', 'E', 'G', 'O', 'B', 'I', 'N', '1'};
+static const uint32_t binary_log_version = 1;
+
+inline size_t binary_element_size(uint32_t type) {
+    switch (static_cast<BinaryElementType>(type)) {
+        case BinaryElementType::Char: return 1;
+        case BinaryElementType::UInt16: return 2;
+        case BinaryElementType::Int32: return 4;
+        case BinaryElementType::UInt64: return 8;
+        case BinaryElementType::Float32: return 4;
+    }
+    return 0;
+}
+
+// A memory-mapped binary log. Columns are accessed in place, without
+// copying; the pointers stay valid as long as the BinaryLog lives.
+class BinaryLog {
+private:
+    MappedFile file_;
+    const BinaryLogColumn* columns_;
+    uint32_t column_count_;
+
+public:
+    BinaryLog() : columns_(nullptr), column_count_(0) {}
+
+    explicit BinaryLog(const std::string& filename) : columns_(nullptr), column_count_(0) {
+        open(filename);
+    }
+
+    // Maps the file and checks header and index. Returns false if the file
+    // is missing, not a binary log, or truncated.
+    bool open(const std::string& filename) {
+        file_ = MappedFile(filename);
+        columns_ = nullptr;
+        column_count_ = 0;
+        if (file_.size() < sizeof(BinaryLogHeader)) return false;
+
+        BinaryLogHeader header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (std::memcmp(header.magic, binary_log_magic, sizeof(header.magic)) != 0 ||
+            header.version != binary_log_version || header.file_size > file_.size() ||
+            sizeof(BinaryLogHeader) + header.column_count * sizeof(BinaryLogColumn) > file_.size()) {
+            return false;
+        }
+        const BinaryLogColumn* columns = reinterpret_cast<const BinaryLogColumn*>(file_.data() + sizeof(BinaryLogHeader));
+        for (uint32_t i = 0; i < header.column_count; ++i) {
+            const BinaryLogColumn& c = columns[i];
+            size_t element = binary_element_size(c.type);
+            if (element == 0 || c.width == 0 || c.offset > file_.size() || c.offset % element != 0 ||
+                c.rows > (file_.size() - c.offset) / element / c.width) {
+                return false;
+            }
+        }
+        columns_ = columns;
+        column_count_ = header.column_count;
+        return true;
+    }
+
+    bool valid() const { return columns_ != nullptr; }
+    size_t file_size() const { return file_.size(); }
+    uint32_t column_count() const { return column_count_; }
+    const BinaryLogColumn& column_at(uint32_t i) const { return columns_[i]; }
+
+    // Returns the column with the given id, or nullptr if it is absent.
+    const BinaryLogColumn* find(BinaryColumnId id) const {
+        for (uint32_t i = 0; i < column_count_; ++i) {
+            if (columns_[i].id == static_cast<uint32_t>(id)) return &columns_[i];
+        }
+        return nullptr;
+    }
+
+    // True if the column holds width values of the given type per row.
+    static bool has_layout(const BinaryLogColumn& column, BinaryElementType type, uint32_t width) {
+        return column.type == static_cast<uint32_t>(type) && column.width == width;
+    }
+
+    template <typename T>
+    const T* data(const BinaryLogColumn& column) const {
+        return reinterpret_cast<const T*>(file_.data() + column.offset);
+    }
+
+    // True if the offsets column of a variable length record is a valid
+    // partition of its values column.
+    bool offsets_valid(const BinaryLogColumn& offsets, const BinaryLogColumn& values) const {
+        if (offsets.rows == 0 || !has_layout(offsets, BinaryElementType::UInt64, 1)) return false;
+        const uint64_t* o = data<uint64_t>(offsets);
+        if (o[0] != 0 || o[offsets.rows - 1] != values.rows) return false;
+        for (uint64_t i = 1; i < offsets.rows; ++i) {
+            if (o[i] < o[i - 1]) return false;
+        }
+        return true;
+    }
+
+    // Zero-copy access to the scans. Check scan_ranges_type() first.
+    size_t scan_count() const {
+        const BinaryLogColumn* offsets = find(BinaryColumnId::ScanOffsets);
+        return offsets != nullptr && offsets->rows > 0 ? offsets->rows - 1 : 0;
+    }
+
+    BinaryElementType scan_ranges_type() const {
+        const BinaryLogColumn* ranges = find(BinaryColumnId::ScanRanges);
+        return ranges != nullptr ? static_cast<BinaryElementType>(ranges->type) : BinaryElementType::Int32;
+    }
+
+    template <typename T>
+    ScanView<T> scan(size_t i) const {
+        const uint64_t* offsets = data<uint64_t>(*find(BinaryColumnId::ScanOffsets));
+        const T* ranges = data<T>(*find(BinaryColumnId::ScanRanges));
+        return ScanView<T>(ranges + offsets[i], static_cast<size_t>(offsets[i + 1] - offsets[i]));
+    }
+};
+
+// Conversion between LegoLogfile and the binary format.
+class LegoLogBinary {
+private:
+    struct PendingColumn {
+        BinaryLogColumn column;
+        std::vector<char> bytes;
+    };
+
+    template <typename Values>
+    static void add_column(std::vector<PendingColumn>& columns, BinaryColumnId id, BinaryElementType type,
+                           uint32_t width, const Values& values) {
+        PendingColumn c;
+        c.column = BinaryLogColumn{static_cast<uint32_t>(id), static_cast<uint32_t>(type), width, 0,
+                                   values.size() / width, 0};
+        c.bytes.resize(values.size() * sizeof(values[0]));
+        if (!values.empty()) std::memcpy(c.bytes.data(), values.data(), c.bytes.size());
+        columns.push_back(std::move(c));
+    }
+
+    template <typename Lists>
+    static std::vector<uint64_t> offsets_of(const Lists& lists) {
+        std::vector<uint64_t> offsets(1, 0);
+        offsets.reserve(lists.size() + 1);
+        for (const auto& l : lists) offsets.push_back(offsets.back() + l.size());
+        return offsets;
+    }
+
+    template <typename T>
+    static void add_scans(std::vector<PendingColumn>& columns, const BasicScanStore<T>& scans, BinaryElementType type) {
+        std::vector<uint64_t> offsets(scans.offsets().begin(), scans.offsets().end());
+        std::vector<T> ranges(scans.ranges().begin(), scans.ranges().begin() + scans.offsets().back());
+        add_column(columns, BinaryColumnId::ScanOffsets, BinaryElementType::UInt64, 1, offsets);
+        add_column(columns, BinaryColumnId::ScanRanges, type, 1, ranges);
+    }
+
+    // Checks that the columns read() loads for the wanted record types have
+    // the types and widths write() gives them, that a record type has
+    // either all of its columns or none, and that timestamps have one row
+    // per record. BinaryLog::open() has already checked that every column
+    // lies inside the file.
+    static bool columns_valid(const BinaryLog& bin, RecordSet wanted) {
+        using T = BinaryElementType;
+        auto fits = [&](BinaryColumnId id, T type, uint32_t width) {
+            const BinaryLogColumn* c = bin.find(id);
+            return c == nullptr || BinaryLog::has_layout(*c, type, width);
+        };
+        // Offsets and values of a variable length record: both or neither.
+        auto lists_valid = [&](BinaryColumnId offsets_id, BinaryColumnId values_id, T type, uint32_t width) {
+            const BinaryLogColumn* offsets = bin.find(offsets_id);
+            const BinaryLogColumn* values = bin.find(values_id);
+            if (offsets == nullptr || values == nullptr) return offsets == values;
+            return BinaryLog::has_layout(*values, type, width) && bin.offsets_valid(*offsets, *values);
+        };
+        // Timestamps need the column they belong to, with as many rows.
+        auto times_valid = [&](BinaryColumnId times_id, uint64_t rows, bool present) {
+            const BinaryLogColumn* times = bin.find(times_id);
+            if (times == nullptr) return true;
+            return present && BinaryLog::has_layout(*times, T::Int32, 1) && times->rows == rows;
+        };
+
+        if (wanted.contains('P') && !fits(BinaryColumnId::ReferencePositions, T::Int32, 2)) return false;
+
+        if (wanted.contains('S')) {
+            const BinaryLogColumn* ranges = bin.find(BinaryColumnId::ScanRanges);
+            T ranges_type = ranges != nullptr && ranges->type == static_cast<uint32_t>(T::UInt16) ? T::UInt16 : T::Int32;
+            if (!lists_valid(BinaryColumnId::ScanOffsets, BinaryColumnId::ScanRanges, ranges_type, 1)) return false;
+            const BinaryLogColumn* offsets = bin.find(BinaryColumnId::ScanOffsets);
+            if (!times_valid(BinaryColumnId::ScanTimestamps, offsets != nullptr ? offsets->rows - 1 : 0, offsets != nullptr)) {
+                return false;
+            }
+        }
+
+        if (wanted.contains('I') && !lists_valid(BinaryColumnId::PoleIndexOffsets, BinaryColumnId::PoleIndices, T::Int32, 1)) {
+            return false;
+        }
+
+        if (wanted.contains('M')) {
+            const BinaryLogColumn* ticks = bin.find(BinaryColumnId::MotorTicks);
+            if (!fits(BinaryColumnId::MotorTicks, T::Int32, 2) ||
+                !times_valid(BinaryColumnId::MotorTimestamps, ticks != nullptr ? ticks->rows : 0, ticks != nullptr) ||
+                !times_valid(BinaryColumnId::MotorStartTimestamp, 1, ticks != nullptr)) {
+                return false;
+            }
+        }
+
+        if (wanted.contains('F') && !fits(BinaryColumnId::FilteredPositions, T::Float32, 3)) return false;
+
+        if (wanted.contains('L')) {
+            const BinaryLogColumn* types = bin.find(BinaryColumnId::LandmarkTypes);
+            const BinaryLogColumn* values = bin.find(BinaryColumnId::Landmarks);
+            if (types == nullptr || values == nullptr) {
+                if (types != values) return false;
+            } else if (!BinaryLog::has_layout(*types, T::Char, 1) || !BinaryLog::has_layout(*values, T::Float32, 3) ||
+                       types->rows != values->rows) {
+                return false;
+            }
+        }
+
+        if (wanted.contains('D') &&
+            !lists_valid(BinaryColumnId::DetectedOffsets, BinaryColumnId::DetectedCylinders, T::Float32, 2)) {
+            return false;
+        }
+        return true;
+    }
+
+public:
+    static bool is_binary(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        char magic[8] = {};
+        file.read(magic, sizeof(magic));
+        return file && std::memcmp(magic, binary_log_magic, sizeof(magic)) == 0;
+    }
+
+    // Writes all non-empty lists of the logfile. Returns false on I/O errors.
+    static bool write(const LegoLogfile& log, const std::string& filename) {
+        std::vector<PendingColumn> columns;
+
+        if (!log.reference_positions.empty()) {
+            std::vector<int32_t> values;
+            values.reserve(log.reference_positions.size() * 2);
+            for (const auto& p : log.reference_positions) {
+                values.push_back(std::get<0>(p));
+                values.push_back(std::get<1>(p));
+            }
+            add_column(columns, BinaryColumnId::ReferencePositions, BinaryElementType::Int32, 2, values);
+        }
+
+        if (!log.scan_data.empty()) {
+            add_scans(columns, log.scan_data, BinaryElementType::Int32);
+        } else if (!log.compact_scan_data.empty()) {
+            add_scans(columns, log.compact_scan_data, BinaryElementType::UInt16);
+        }
+        if (!log.scan_timestamps.empty()) {
+            add_column(columns, BinaryColumnId::ScanTimestamps, BinaryElementType::Int32, 1, log.scan_timestamps);
+        }
+
+        if (!log.pole_indices.empty()) {
+            std::vector<int32_t> values;
+            for (const auto& indices : log.pole_indices) values.insert(values.end(), indices.begin(), indices.end());
+            add_column(columns, BinaryColumnId::PoleIndexOffsets, BinaryElementType::UInt64, 1, offsets_of(log.pole_indices));
+            add_column(columns, BinaryColumnId::PoleIndices, BinaryElementType::Int32, 1, values);
+        }
+
+        if (!log.motor_ticks.empty()) {
+            std::vector<int32_t> values;
+            values.reserve(log.motor_ticks.size() * 2);
+            for (const auto& t : log.motor_ticks) {
+                values.push_back(std::get<0>(t));
+                values.push_back(std::get<1>(t));
+            }
+            add_column(columns, BinaryColumnId::MotorTicks, BinaryElementType::Int32, 2, values);
+        }
+        if (!log.motor_timestamps.empty()) {
+            add_column(columns, BinaryColumnId::MotorTimestamps, BinaryElementType::Int32, 1, log.motor_timestamps);
+        }
+        if (!log.motor_ticks.empty()) {
+            std::vector<int32_t> start(1, log.motor_start_timestamp);
+            add_column(columns, BinaryColumnId::MotorStartTimestamp, BinaryElementType::Int32, 1, start);
+        }
+
+        if (!log.filtered_positions.empty()) {
+            std::vector<float> values;
+            values.reserve(log.filtered_positions.size() * 3);
+            for (const auto& f : log.filtered_positions) {
+                values.push_back(std::get<0>(f));
+                values.push_back(std::get<1>(f));
+                values.push_back(std::get<2>(f));
+            }
+            add_column(columns, BinaryColumnId::FilteredPositions, BinaryElementType::Float32, 3, values);
+        }
+
+        if (!log.landmarks.empty()) {
+            std::vector<char> types;
+            std::vector<float> values;
+            for (const auto& l : log.landmarks) {
+                types.push_back(std::get<0>(l));
+                values.push_back(std::get<1>(l));
+                values.push_back(std::get<2>(l));
+                values.push_back(std::get<3>(l));
+            }
+            add_column(columns, BinaryColumnId::LandmarkTypes, BinaryElementType::Char, 1, types);
+            add_column(columns, BinaryColumnId::Landmarks, BinaryElementType::Float32, 3, values);
+        }
+
+        if (!log.detected_cylinders.empty()) {
+            std::vector<float> values;
+            for (const auto& cylinders : log.detected_cylinders) {
+                for (const auto& c : cylinders) {
+                    values.push_back(std::get<0>(c));
+                    values.push_back(std::get<1>(c));
+                }
+            }
+            add_column(columns, BinaryColumnId::DetectedOffsets, BinaryElementType::UInt64, 1, offsets_of(log.detected_cylinders));
+            add_column(columns, BinaryColumnId::DetectedCylinders, BinaryElementType::Float32, 2, values);
+        }
+
+        // Lay out the columns behind header and index, 64 byte aligned.
+        uint64_t offset = sizeof(BinaryLogHeader) + columns.size() * sizeof(BinaryLogColumn);
+        for (auto& c : columns) {
+            offset = (offset + 63) & ~uint64_t(63);
+            c.column.offset = offset;
+            offset += c.bytes.size();
+        }
+
+        BinaryLogHeader header;
+        std::memcpy(header.magic, binary_log_magic, sizeof(header.magic));
+        header.version = binary_log_version;
+        header.column_count = static_cast<uint32_t>(columns.size());
+        header.file_size = offset;
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& c : columns) file.write(reinterpret_cast<const char*>(&c.column), sizeof(c.column));
+        uint64_t position = sizeof(BinaryLogHeader) + columns.size() * sizeof(BinaryLogColumn);
+        static const char padding[64] = {};
+        for (const auto& c : columns) {
+            file.write(padding, static_cast<std::streamsize>(c.column.offset - position));
+            file.write(c.bytes.data(), static_cast<std::streamsize>(c.bytes.size()));
+            position = c.column.offset + c.bytes.size();
+        }
+        return static_cast<bool>(file);
+    }
+
+    // Loads a binary log into the logfile. Like LegoLogfile::read(), every
+    // list present in the file replaces the one in the logfile, and the
+    // others are kept. Only the record types in wanted are loaded. Returns
+    // false, without changing the logfile, if the file is not a valid
+    // binary log or a wanted column does not have the expected layout.
+    static bool read(LegoLogfile& log, const std::string& filename, RecordSet wanted = RecordSet::all()) {
+        BinaryLog bin(filename);
+        if (!bin.valid() || !columns_valid(bin, wanted)) return false;
+
+        const BinaryLogColumn* c = bin.find(BinaryColumnId::ReferencePositions);
+        if (c != nullptr && wanted.contains('P')) {
+            const int32_t* v = bin.data<int32_t>(*c);
+            log.reference_positions.clear();
+            log.reference_positions.reserve(c->rows);
+            for (uint64_t i = 0; i < c->rows; ++i) log.reference_positions.emplace_back(v[2 * i], v[2 * i + 1]);
+        }
+
+        const BinaryLogColumn* scan_offsets = bin.find(BinaryColumnId::ScanOffsets);
+        const BinaryLogColumn* scan_ranges = bin.find(BinaryColumnId::ScanRanges);
+        if (scan_offsets != nullptr && wanted.contains('S')) {
+            const uint64_t* offsets = bin.data<uint64_t>(*scan_offsets);
+            size_t scans = scan_offsets->rows - 1;
+            log.scan_data.clear();
+            log.compact_scan_data.clear();
+            log.scan_timestamps.clear();
+            if (const BinaryLogColumn* times = bin.find(BinaryColumnId::ScanTimestamps)) {
+                const int32_t* t = bin.data<int32_t>(*times);
+                log.scan_timestamps.assign(t, t + times->rows);
+            }
+            if (scan_ranges->type == static_cast<uint32_t>(BinaryElementType::UInt16)) {
+                const uint16_t* ranges = bin.data<uint16_t>(*scan_ranges);
+                if (log.compact_scans) log.compact_scan_data.assign(ranges, offsets, scans);
+                else log.scan_data.assign(ranges, offsets, scans);
+            } else {
+                const int32_t* ranges = bin.data<int32_t>(*scan_ranges);
+                if (log.compact_scans) log.compact_scan_data.assign(ranges, offsets, scans);
+                else log.scan_data.assign(ranges, offsets, scans);
+            }
+        }
+
+        const BinaryLogColumn* pole_offsets = bin.find(BinaryColumnId::PoleIndexOffsets);
+        const BinaryLogColumn* pole_values = bin.find(BinaryColumnId::PoleIndices);
+        if (pole_offsets != nullptr && wanted.contains('I')) {
+            const uint64_t* offsets = bin.data<uint64_t>(*pole_offsets);
+            const int32_t* v = bin.data<int32_t>(*pole_values);
+            log.pole_indices.clear();
+            log.pole_indices.reserve(pole_offsets->rows - 1);
+            for (uint64_t i = 0; i + 1 < pole_offsets->rows; ++i) {
+                log.pole_indices.emplace_back(v + offsets[i], v + offsets[i + 1]);
+            }
+        }
+
+        c = bin.find(BinaryColumnId::MotorTicks);
+        if (c != nullptr && wanted.contains('M')) {
+            const int32_t* v = bin.data<int32_t>(*c);
+            log.motor_ticks.clear();
+            log.motor_ticks.reserve(c->rows);
+            for (uint64_t i = 0; i < c->rows; ++i) log.motor_ticks.emplace_back(v[2 * i], v[2 * i + 1]);
+            log.motor_timestamps.clear();
+            if (const BinaryLogColumn* times = bin.find(BinaryColumnId::MotorTimestamps)) {
+                const int32_t* t = bin.data<int32_t>(*times);
+                log.motor_timestamps.assign(t, t + times->rows);
+            }
+            // Files written before the start time was kept: the first
+            // difference's time is the best guess.
+            log.motor_start_timestamp = log.motor_timestamps.empty() ? 0 : log.motor_timestamps[0];
+            if (const BinaryLogColumn* start = bin.find(BinaryColumnId::MotorStartTimestamp)) {
+                log.motor_start_timestamp = *bin.data<int32_t>(*start);
+            }
+        }
+
+        c = bin.find(BinaryColumnId::FilteredPositions);
+        if (c != nullptr && wanted.contains('F')) {
+            const float* v = bin.data<float>(*c);
+            log.filtered_positions.clear();
+            log.filtered_positions.reserve(c->rows);
+            for (uint64_t i = 0; i < c->rows; ++i) log.filtered_positions.emplace_back(v[3 * i], v[3 * i + 1], v[3 * i + 2]);
+        }
+
+        const BinaryLogColumn* landmark_types = bin.find(BinaryColumnId::LandmarkTypes);
+        const BinaryLogColumn* landmark_values = bin.find(BinaryColumnId::Landmarks);
+        if (landmark_types != nullptr && wanted.contains('L')) {
+            const char* types = bin.data<char>(*landmark_types);
+            const float* v = bin.data<float>(*landmark_values);
+            log.landmarks.clear();
+            log.landmarks.reserve(landmark_values->rows);
+            for (uint64_t i = 0; i < landmark_values->rows; ++i) {
+                log.landmarks.emplace_back(types[i], v[3 * i], v[3 * i + 1], v[3 * i + 2]);
+            }
+        }
+
+        const BinaryLogColumn* detected_offsets = bin.find(BinaryColumnId::DetectedOffsets);
+        const BinaryLogColumn* detected_values = bin.find(BinaryColumnId::DetectedCylinders);
+        if (detected_offsets != nullptr && wanted.contains('D')) {
+            const uint64_t* offsets = bin.data<uint64_t>(*detected_offsets);
+            const float* v = bin.data<float>(*detected_values);
+            log.detected_cylinders.clear();
+            log.detected_cylinders.reserve(detected_offsets->rows - 1);
+            for (uint64_t i = 0; i + 1 < detected_offsets->rows; ++i) {
+                auto& cylinders = log.detected_cylinders.emplace_back();
+                cylinders.reserve(offsets[i + 1] - offsets[i]);
+                for (uint64_t j = offsets[i]; j < offsets[i + 1]; ++j) cylinders.emplace_back(v[2 * j], v[2 * j + 1]);
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "lego_robot.h"
+#include "lego_log_binary.h"
+#include "mapped_file.h"
+
+// On-disk cache of parsed text logs, so that repeated tool runs skip the
+// parsing:
+//
+//     LegoLogfile logfile;
+//     LogCache::read(logfile, "robot4_motors.txt", RecordSet("M"));
+//
+// behaves like logfile.read_mapped("robot4_motors.txt", RecordSet("M")).
+// The first call parses the whole log (all record types) and stores it in
+// the binary format of lego_log_binary.h; later calls load that instead.
+//
+// Cache files live in $LEGO_LOG_CACHE, or else $XDG_CACHE_HOME/lego_robot
+// or ~/.cache/lego_robot, named after a hash of the absolute path of the
+// log, so read-only data directories work too. Each is a binary log
+// followed by the path and a LogCacheFooter with size, modification time
+// and content hash of the log. A cache file is used if path, size and
+// modification time match. If only the time differs (the log was touched
+// or copied), the content hash decides, and a match updates the time. So
+// does the hash if the log was modified less than mtime_granularity_ns
+// before the cache file was written: a log changed again within the same
+// tick of the file system clock keeps its time. Cache files are only ever
+// replaced whole, by way of a temporary file.
+struct LogCacheFooter {
+    char magic[8];
+    uint32_t version;
+    uint32_t types_seen;   // Record types the log has, bit i for 'A' + i
+    uint64_t body_size;    // Size of the binary log in front of the path
+    uint64_t path_size;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t content_hash;
+};
+
+static const char log_cache_magic[8] = {'L', 'E', 'G', 'O', 'C', 'C', 'H', '1'};
+static const uint32_t log_cache_version = 2; // 2: binary logs keep motor_start_timestamp
+
+class LogCache {
+private:
+    static bool stat_source(const std::string& filename, uint64_t& size, int64_t& mtime_ns) {
+        struct stat st;
+        if (::stat(filename.c_str(), &st) != 0) return false;
+        size = static_cast<uint64_t>(st.st_size);
+        mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+
+    static std::string absolute_path(const std::string& filename) {
+        char path[PATH_MAX];
+        return ::realpath(filename.c_str(), path) != nullptr ? std::string(path) : filename;
+    }
+
+    // Creates directory and its parents. Returns false if that fails.
+    static bool make_directories(const std::string& directory) {
+        for (size_t slash = directory.find('/', 1); ; slash = directory.find('/', slash + 1)) {
+            std::string part = directory.substr(0, slash);
+            if (::mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+            if (slash == std::string::npos) return true;
+        }
+    }
+
+    // Reads footer and path of a cache file. Returns false if it is not one.
+    static bool read_footer(const std::string& cache, LogCacheFooter& footer, std::string& path) {
+        std::ifstream file(cache, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return false;
+        uint64_t size = static_cast<uint64_t>(file.tellg());
+        if (size < sizeof(LogCacheFooter)) return false;
+        file.seekg(static_cast<std::streamoff>(size - sizeof(LogCacheFooter)));
+        file.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+        if (!file || std::memcmp(footer.magic, log_cache_magic, sizeof(footer.magic)) != 0 ||
+            footer.version != log_cache_version || footer.path_size > size ||
+            footer.body_size + footer.path_size + sizeof(LogCacheFooter) != size) {
+            return false;
+        }
+        path.resize(footer.path_size);
+        file.seekg(static_cast<std::streamoff>(footer.body_size));
+        file.read(&path[0], static_cast<std::streamsize>(path.size()));
+        return static_cast<bool>(file);
+    }
+
+    // Parses the whole log and writes its cache file, by way of a temporary
+    // file, so a concurrent reader never sees half a cache.
+    static bool build(const std::string& filename, const std::string& path, const std::string& cache,
+                      uint64_t source_size, int64_t source_mtime_ns) {
+        MappedFile file(filename);
+        if (file.size() != source_size) return false;
+        LegoLogfile log;
+        LegoLogfile::ReadState state;
+        log.parse_range(file.begin(), file.end(), state);
+
+        LogCacheFooter footer;
+        std::memcpy(footer.magic, log_cache_magic, sizeof(footer.magic));
+        footer.version = log_cache_version;
+        footer.types_seen = state.seen.bits();
+        footer.path_size = path.size();
+        footer.source_size = source_size;
+        footer.source_mtime_ns = source_mtime_ns;
+        footer.content_hash = content_hash(file.data(), file.size());
+
+        return replace_file(cache, [&](const std::string& temporary) {
+            if (!LegoLogBinary::write(log, temporary)) return false;
+            std::ofstream out(temporary, std::ios::binary | std::ios::ate | std::ios::in | std::ios::out);
+            footer.body_size = static_cast<uint64_t>(out.tellp());
+            out.write(path.data(), static_cast<std::streamsize>(path.size()));
+            out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+            out.close();
+            return static_cast<bool>(out);
+        });
+    }
+
+    // Replaces the footer of a cache file, if the file still ends with
+    // footer old, by way of a temporary copy.
+    static bool rewrite_footer(const std::string& cache, const LogCacheFooter& old, const LogCacheFooter& footer) {
+        MappedFile file(cache);
+        if (file.size() < sizeof(footer) || std::memcmp(file.end() - sizeof(old), &old, sizeof(old)) != 0) return false;
+        return replace_file(cache, [&](const std::string& temporary) {
+            std::ofstream out(temporary, std::ios::binary);
+            out.write(file.data(), static_cast<std::streamsize>(file.size() - sizeof(footer)));
+            out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+            out.close();
+            return static_cast<bool>(out);
+        });
+    }
+
+    // Loads the wanted types of a cache file into log, with the merge
+    // behaviour of read_mapped(): types the log has replace the lists of
+    // log, even if they come out empty.
+    static bool load(LegoLogfile& log, const std::string& cache, uint32_t types_seen, RecordSet wanted) {
+        BinaryLog bin(cache);
+        if (!bin.valid()) return false;
+        std::string types;
+        for (const char* t = "PSIMFLD"; *t != '\0'; ++t) {
+            if (wanted.contains(*t) && (types_seen & (uint32_t(1) << (*t - 'A'))) != 0) types += *t;
+        }
+        for (char t : types) {
+            switch (t) {
+                case 'P': log.reference_positions.clear(); break;
+                case 'S': log.scan_data.clear(); log.compact_scan_data.clear(); log.scan_timestamps.clear(); break;
+                case 'I': log.pole_indices.clear(); break;
+                case 'M': log.motor_ticks.clear(); log.motor_timestamps.clear(); break;
+                case 'F': log.filtered_positions.clear(); break;
+                case 'L': log.landmarks.clear(); break;
+                case 'D': log.detected_cylinders.clear(); break;
+            }
+        }
+        return LegoLogBinary::read(log, cache, RecordSet(types.c_str()));
+    }
+
+public:
+    // The directory of the cache files, or "" if there is none.
+    static std::string directory() {
+        if (const char* dir = std::getenv("LEGO_LOG_CACHE")) return dir;
+        if (const char* dir = std::getenv("XDG_CACHE_HOME")) return std::string(dir) + "/lego_robot";
+        if (const char* home = std::getenv("HOME")) return std::string(home) + "/.cache/lego_robot";
+        return "";
+    }
+
+    // The cache file of a log.
+    static std::string cache_name(const std::string& filename) {
+        std::string path = absolute_path(filename);
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.lgb",
+                      static_cast<unsigned long long>(content_hash(path.data(), path.size())));
+        return directory() + name;
+    }
+
+    // Same as log.read_mapped(filename, wanted), from the cache if it is up
+    // to date. Otherwise the log is parsed and the cache file (re)written.
+    // Returns true if the records came from the cache.
+    static bool read(LegoLogfile& log, const std::string& filename, RecordSet wanted = RecordSet::all()) {
+        uint64_t size;
+        int64_t mtime_ns;
+        std::string dir = directory();
+        if (dir.empty() || !stat_source(filename, size, mtime_ns)) {
+            log.read_mapped(filename, wanted);
+            return false;
+        }
+        std::string path = absolute_path(filename);
+        std::string cache = cache_name(filename);
+
+        LogCacheFooter footer;
+        std::string cached_path;
+        uint64_t cache_size;
+        int64_t cache_mtime_ns;
+        if (read_footer(cache, footer, cached_path) && cached_path == path && footer.source_size == size &&
+            stat_source(cache, cache_size, cache_mtime_ns)) {
+            bool racy = mtime_ns > cache_mtime_ns - mtime_granularity_ns;
+            bool valid = footer.source_mtime_ns == mtime_ns && !racy;
+            if (!valid) {
+                // Same size, but the time differs or proves nothing:
+                // compare the contents.
+                MappedFile file(filename);
+                valid = file.size() == size && content_hash(file.data(), file.size()) == footer.content_hash;
+                // Store the new time, and once the log is older than the
+                // granularity, rewrite the cache so that it is no longer racy.
+                if (valid && (footer.source_mtime_ns != mtime_ns || realtime_ns() - mtime_ns > mtime_granularity_ns)) {
+                    LogCacheFooter updated = footer;
+                    updated.source_mtime_ns = mtime_ns;
+                    if (rewrite_footer(cache, footer, updated)) footer = updated;
+                }
+            }
+            if (valid && load(log, cache, footer.types_seen, wanted)) return true;
+        }
+
+        if (make_directories(dir) && build(filename, path, cache, size, mtime_ns) &&
+            read_footer(cache, footer, cached_path) && load(log, cache, footer.types_seen, wanted)) {
+            return false;
+        }
+        log.read_mapped(filename, wanted);
+        return false;
+    }
+};
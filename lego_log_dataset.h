@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lego_robot.h"
+#include "lego_log_binary.h"
+
+// A long run stored as a directory of segments, so that a query reads only
+// the part of the run it needs:
+//
+//     LegoDataset::write(logfile, "run42", 10000);   // or append()
+//
+//     LegoDataset dataset("run42");
+//     LegoLogfile log;
+//     dataset.read(log, 'S', 120000, 10000);          // scans 120000 .. 129999
+//     dataset.read_time(log, 'M', 40 * 60000, 45 * 60000 - 1);
+//
+// Each segment (segment_000000.lgb, ..., segment_999999.lgb,
+// segment_1000000.lgb, ...) is a binary log (see lego_log_binary.h) holding
+// a consecutive range of records of every type, followed by a SegmentFooter
+// with the numbers of its first records in the whole run and the time
+// bounds of its S and M records. Opening a dataset
+// reads only the footers; a query maps only the segments that hold records
+// of the requested range, and reads only the columns of the requested type.
+//
+// Record numbers are per type, as in LogIndex: record n of M is
+// motor_ticks[n] of the whole run. Time queries assume that timestamps do
+// not decrease within a type, which holds for our robot's logs.
+
+// The record types a segment holds, in the order of the footer arrays.
+static const char segment_record_types[] = "PSIMFLD";
+static const size_t segment_type_count = 7;
+
+struct SegmentFooter {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t body_size;                  // Size of the binary log in front of the footer
+    uint64_t first[segment_type_count];  // Number of the first record in the run, by type
+    uint64_t count[segment_type_count];  // Number of records in this segment
+    int32_t first_time[segment_type_count]; // Time bounds, for S and M; first_time > last_time
+    int32_t last_time[segment_type_count];  // if the segment has no timestamps of that type
+};
+
+static const char segment_footer_magic[8] = {'L', 'E', 'G', 'O', 'S', 'E', 'G', '1'};
+static const uint32_t segment_footer_version = 1;
+
+class LegoDataset {
+private:
+    struct Segment {
+        std::string filename;
+        SegmentFooter footer;
+    };
+
+    std::string directory_;
+    std::vector<Segment> segments_;
+    mutable size_t segments_opened_ = 0;
+
+    // Position of type in segment_record_types, or -1.
+    static int type_slot(char type) {
+        const char* p = type != 0 ? std::strchr(segment_record_types, type) : nullptr;
+        return p != nullptr ? static_cast<int>(p - segment_record_types) : -1;
+    }
+
+    static std::string segment_name(size_t k) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "segment_%06zu.lgb", k);
+        return name;
+    }
+
+    // segment_ followed by at least six digits and .lgb; numbers beyond
+    // 999999 just take more digits.
+    static bool is_segment_name(const std::string& name) {
+        if (name.size() < 18 || name.compare(0, 8, "segment_") != 0 || name.compare(name.size() - 4, 4, ".lgb") != 0) {
+            return false;
+        }
+        return std::all_of(name.begin() + 8, name.end() - 4, [](char c) { return c >= '0' && c <= '9'; });
+    }
+
+    // The segment file names in a directory, in the order of their numbers.
+    static std::vector<std::string> list_segments(const std::string& directory) {
+        std::vector<std::string> names;
+        DIR* dir = ::opendir(directory.c_str());
+        if (dir == nullptr) return names;
+        while (const dirent* entry = ::readdir(dir)) {
+            if (is_segment_name(entry->d_name)) names.push_back(entry->d_name);
+        }
+        ::closedir(dir);
+        // Shorter names have smaller numbers.
+        std::sort(names.begin(), names.end(), [](const std::string& a, const std::string& b) {
+            return a.size() != b.size() ? a.size() < b.size() : a < b;
+        });
+        return names;
+    }
+
+    static bool read_footer(const std::string& filename, SegmentFooter& footer) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return false;
+        std::streamoff size = file.tellg();
+        if (size < static_cast<std::streamoff>(sizeof(SegmentFooter))) return false;
+        file.seekg(size - static_cast<std::streamoff>(sizeof(SegmentFooter)));
+        file.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+        return file && std::memcmp(footer.magic, segment_footer_magic, sizeof(footer.magic)) == 0 &&
+               footer.version == segment_footer_version &&
+               footer.body_size + sizeof(SegmentFooter) == static_cast<uint64_t>(size);
+    }
+
+    // Number of records of a type in log.
+    static size_t list_size(const LegoLogfile& log, char type) {
+        switch (type) {
+            case 'P': return log.reference_positions.size();
+            case 'S': return log.scan_data.size() + log.compact_scan_data.size();
+            case 'I': return log.pole_indices.size();
+            case 'M': return log.motor_ticks.size();
+            case 'F': return log.filtered_positions.size();
+            case 'L': return log.landmarks.size();
+            case 'D': return log.detected_cylinders.size();
+        }
+        return 0;
+    }
+
+    // Empties the list (and timestamps) of a type in log.
+    static void clear_list(LegoLogfile& log, char type) {
+        switch (type) {
+            case 'P': log.reference_positions.clear(); break;
+            case 'S': log.scan_data.clear(); log.compact_scan_data.clear(); log.scan_timestamps.clear(); break;
+            case 'I': log.pole_indices.clear(); break;
+            case 'M': log.motor_ticks.clear(); log.motor_timestamps.clear(); break;
+            case 'F': log.filtered_positions.clear(); break;
+            case 'L': log.landmarks.clear(); break;
+            case 'D': log.detected_cylinders.clear(); break;
+        }
+    }
+
+    template <typename List>
+    static void append_range(List& to, const List& from, size_t first, size_t last) {
+        last = std::min(last, from.size());
+        if (first < last) to.insert(to.end(), from.begin() + first, from.begin() + last);
+    }
+
+    // Appends records first .. last - 1 of a type from one logfile to
+    // another, with their timestamps.
+    static void append_records(LegoLogfile& to, const LegoLogfile& from, char type, size_t first, size_t last) {
+        switch (type) {
+            case 'P': append_range(to.reference_positions, from.reference_positions, first, last); break;
+            case 'S':
+                for (size_t i = first; i < last && i < from.scan_data.size(); ++i) {
+                    if (to.compact_scans) to.compact_scan_data.push_back(from.scan_data[i]);
+                    else to.scan_data.push_back(from.scan_data[i]);
+                }
+                for (size_t i = first; i < last && i < from.compact_scan_data.size(); ++i) {
+                    if (to.compact_scans) to.compact_scan_data.push_back(from.compact_scan_data[i]);
+                    else to.scan_data.push_back(from.compact_scan_data[i]);
+                }
+                append_range(to.scan_timestamps, from.scan_timestamps, first, last);
+                break;
+            case 'I':
+                for (size_t i = first; i < last && i < from.pole_indices.size(); ++i) {
+                    to.pole_indices.emplace_back(from.pole_indices[i].begin(), from.pole_indices[i].end());
+                }
+                break;
+            case 'M':
+                // The time before the first appended difference.
+                if (to.motor_ticks.empty() && first < from.motor_ticks.size()) {
+                    to.motor_start_timestamp = first == 0 ? from.motor_start_timestamp
+                                             : first <= from.motor_timestamps.size() ? from.motor_timestamps[first - 1] : 0;
+                }
+                append_range(to.motor_ticks, from.motor_ticks, first, last);
+                append_range(to.motor_timestamps, from.motor_timestamps, first, last);
+                break;
+            case 'F': append_range(to.filtered_positions, from.filtered_positions, first, last); break;
+            case 'L': append_range(to.landmarks, from.landmarks, first, last); break;
+            case 'D':
+                for (size_t i = first; i < last && i < from.detected_cylinders.size(); ++i) {
+                    to.detected_cylinders.emplace_back(from.detected_cylinders[i].begin(), from.detected_cylinders[i].end());
+                }
+                break;
+        }
+    }
+
+    // Smallest and largest timestamp of a type, for the footer.
+    template <typename Times>
+    static void time_bounds(const Times& times, int32_t& first_time, int32_t& last_time) {
+        first_time = std::numeric_limits<int32_t>::max();
+        last_time = std::numeric_limits<int32_t>::min();
+        for (int t : times) {
+            first_time = std::min(first_time, static_cast<int32_t>(t));
+            last_time = std::max(last_time, static_cast<int32_t>(t));
+        }
+    }
+
+    // Timestamps of S or M records in a segment, without copying them.
+    // Returns nullptr if the segment has none.
+    static const int32_t* segment_times(const BinaryLog& bin, char type, uint64_t& rows) {
+        const BinaryLogColumn* c = bin.find(type == 'S' ? BinaryColumnId::ScanTimestamps : BinaryColumnId::MotorTimestamps);
+        if (c == nullptr || !BinaryLog::has_layout(*c, BinaryElementType::Int32, 1)) return nullptr;
+        rows = c->rows;
+        return bin.data<int32_t>(*c);
+    }
+
+public:
+    LegoDataset() {}
+
+    explicit LegoDataset(const std::string& directory) { open(directory); }
+
+    // Reads the footers of all segments in directory. Returns false if a
+    // segment is not valid or does not continue the one before it.
+    bool open(const std::string& directory) {
+        directory_ = directory;
+        segments_.clear();
+        for (const std::string& name : list_segments(directory)) {
+            Segment segment;
+            segment.filename = directory + "/" + name;
+            if (!read_footer(segment.filename, segment.footer)) {
+                segments_.clear();
+                return false;
+            }
+            if (!segments_.empty()) {
+                const SegmentFooter& before = segments_.back().footer;
+                for (size_t t = 0; t < segment_type_count; ++t) {
+                    if (segment.footer.first[t] != before.first[t] + before.count[t]) {
+                        segments_.clear();
+                        return false;
+                    }
+                }
+            }
+            segments_.push_back(segment);
+        }
+        return true;
+    }
+
+    size_t segment_count() const { return segments_.size(); }
+    const SegmentFooter& footer(size_t k) const { return segments_[k].footer; }
+
+    // Number of segments mapped by queries so far.
+    size_t segments_opened() const { return segments_opened_; }
+
+    // Number of records of a type in the whole run.
+    size_t count(char type) const {
+        int t = type_slot(type);
+        if (t < 0 || segments_.empty()) return 0;
+        const SegmentFooter& last = segments_.back().footer;
+        return static_cast<size_t>(last.first[t] + last.count[t]);
+    }
+
+    // Reads records first .. first + count - 1 of one type into log, which
+    // then holds them at positions 0 .. count - 1 of the list of that type
+    // (with their timestamps, for S and M). Other lists of log are not
+    // touched. Returns false if a segment cannot be read.
+    bool read(LegoLogfile& log, char type, size_t first, size_t count) const {
+        clear_list(log, type);
+        int t = type_slot(type);
+        if (t < 0) return true;
+        char types[2] = {type, 0};
+        size_t last = first + count;
+        for (const Segment& segment : segments_) {
+            const SegmentFooter& f = segment.footer;
+            size_t begin = std::max(first, static_cast<size_t>(f.first[t]));
+            size_t end = std::min(last, static_cast<size_t>(f.first[t] + f.count[t]));
+            if (begin >= end) continue;
+            LegoLogfile part;
+            part.compact_scans = log.compact_scans;
+            ++segments_opened_;
+            if (!LegoLogBinary::read(part, segment.filename, RecordSet(types))) return false;
+            append_records(log, part, type, begin - f.first[t], end - f.first[t]);
+        }
+        return true;
+    }
+
+    // The range [first, last) of S or M records whose timestamps lie in
+    // [first_time, last_time]. Segments that lie completely inside or
+    // outside the interval are not opened.
+    std::pair<size_t, size_t> find_time(char type, int first_time, int last_time) const {
+        int t = type_slot(type);
+        size_t first = 0, last = 0;
+        bool found = false;
+        if (type != 'S' && type != 'M') return std::make_pair(first, last);
+        for (const Segment& segment : segments_) {
+            const SegmentFooter& f = segment.footer;
+            if (f.first_time[t] > f.last_time[t] || f.last_time[t] < first_time || f.first_time[t] > last_time) continue;
+            uint64_t begin = 0, end = f.count[t];
+            if (f.first_time[t] < first_time || f.last_time[t] > last_time) {
+                BinaryLog bin(segment.filename);
+                ++segments_opened_;
+                uint64_t rows = 0;
+                const int32_t* times = bin.valid() ? segment_times(bin, type, rows) : nullptr;
+                if (times == nullptr) continue;
+                begin = static_cast<uint64_t>(std::lower_bound(times, times + rows, first_time) - times);
+                end = static_cast<uint64_t>(std::upper_bound(times, times + rows, last_time) - times);
+                if (begin >= end) continue;
+            }
+            if (!found) first = static_cast<size_t>(f.first[t] + begin);
+            found = true;
+            last = static_cast<size_t>(f.first[t] + end);
+        }
+        return std::make_pair(first, last);
+    }
+
+    // Reads the S or M records with timestamps in [first_time, last_time]
+    // into log, as read() does. Returns the number of records.
+    size_t read_time(LegoLogfile& log, char type, int first_time, int last_time) const {
+        std::pair<size_t, size_t> range = find_time(type, first_time, last_time);
+        if (!read(log, type, range.first, range.second - range.first)) return 0;
+        return range.second - range.first;
+    }
+
+    // Appends the records of log to the dataset in directory (created if
+    // needed), records_per_segment records of each type per segment.
+    // Returns false on I/O errors.
+    static bool append(const LegoLogfile& log, const std::string& directory, size_t records_per_segment = 10000) {
+        ::mkdir(directory.c_str(), 0755);
+        LegoDataset dataset;
+        if (!dataset.open(directory)) return false;
+        uint64_t next[segment_type_count] = {};
+        for (size_t t = 0; t < segment_type_count; ++t) next[t] = dataset.count(segment_record_types[t]);
+
+        size_t records = 0;
+        for (const char* type = segment_record_types; *type != '\0'; ++type) {
+            records = std::max(records, list_size(log, *type));
+        }
+        if (records_per_segment == 0) records_per_segment = std::max<size_t>(records, 1);
+
+        for (size_t k = 0, first = 0; first < records; ++k, first += records_per_segment) {
+            size_t last = first + records_per_segment;
+            LegoLogfile part;
+            part.compact_scans = !log.compact_scan_data.empty();
+            SegmentFooter footer;
+            std::memcpy(footer.magic, segment_footer_magic, sizeof(footer.magic));
+            footer.version = segment_footer_version;
+            footer.reserved = 0;
+            for (size_t t = 0; t < segment_type_count; ++t) {
+                char type = segment_record_types[t];
+                append_records(part, log, type, first, last);
+                footer.first[t] = next[t];
+                footer.count[t] = list_size(part, type);
+                next[t] += footer.count[t];
+                footer.first_time[t] = std::numeric_limits<int32_t>::max();
+                footer.last_time[t] = std::numeric_limits<int32_t>::min();
+            }
+            time_bounds(part.scan_timestamps, footer.first_time[type_slot('S')], footer.last_time[type_slot('S')]);
+            time_bounds(part.motor_timestamps, footer.first_time[type_slot('M')], footer.last_time[type_slot('M')]);
+
+            std::string filename = directory + "/" + segment_name(dataset.segment_count() + k);
+            if (!LegoLogBinary::write(part, filename)) return false;
+            std::ofstream file(filename, std::ios::binary | std::ios::ate | std::ios::in | std::ios::out);
+            footer.body_size = static_cast<uint64_t>(file.tellp());
+            file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+            if (!file) return false;
+        }
+        return true;
+    }
+
+    // Writes log as a new dataset, replacing the segments in directory.
+    static bool write(const LegoLogfile& log, const std::string& directory, size_t records_per_segment = 10000) {
+        for (const std::string& name : list_segments(directory)) ::unlink((directory + "/" + name).c_str());
+        return append(log, directory, records_per_segment);
+    }
+};
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "lego_robot.h"
+#include "mapped_file.h"
+
+// Byte offsets of the records of a text log, by record type and sequence
+// number, kept in a sidecar file next to the log (<log>.idx).
+//
+// Sidecar layout (native byte order):
+//   LogIndexHeader
+//   LogIndexEntry[type_count]   type and number of records of that type
+//   uint64_t offsets            the offsets of each type, in entry order
+//
+// The header stores size, modification time and content hash of the log,
+// with the same rules as LogCache: if the size has changed, the sidecar is
+// stale and the index is rebuilt. If only the time differs, or the log was
+// modified less than mtime_granularity_ns before the sidecar was written
+// (so it may have changed again within the same clock tick), the content
+// hash decides, and a match writes the sidecar again with the new time.
+struct LogIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t type_count;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t content_hash;
+};
+
+struct LogIndexEntry {
+    uint32_t type; // Record type character
+    uint32_t reserved;
+    uint64_t count;
+};
+
+static const char log_index_magic[8] = {'L', 'E', 'G', 'O', 'I', 'D', 'X', '1'};
+static const uint32_t log_index_version = 3; // 2: lines with too few fields are not indexed, 3: content hash
+
+class LogIndex {
+private:
+    std::vector<uint64_t> offsets_[26]; // By record type 'A' .. 'Z'
+    uint64_t source_size_ = 0;
+    int64_t source_mtime_ns_ = 0;
+    uint64_t content_hash_ = 0;
+
+    static int slot(char type) { return type >= 'A' && type <= 'Z' ? type - 'A' : -1; }
+
+    static bool stat_source(const std::string& filename, uint64_t& size, int64_t& mtime_ns) {
+        struct stat st;
+        if (::stat(filename.c_str(), &st) != 0) return false;
+        size = static_cast<uint64_t>(st.st_size);
+        mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+
+public:
+    static std::string sidecar_name(const std::string& filename) { return filename + ".idx"; }
+
+    // Number of records of a type.
+    size_t count(char type) const {
+        int s = slot(type);
+        return s < 0 ? 0 : offsets_[s].size();
+    }
+
+    // Byte offset of record n of a type. n must be below count(type).
+    uint64_t offset(char type, size_t n) const { return offsets_[slot(type)][n]; }
+
+    // Indexes the lines of a mapped log. Like LegoLogfile::read(), the log
+    // ends at the first blank line, and lines with too few fields are
+    // skipped, so record n here is record n of a full read.
+    void build(const MappedFile& file, uint64_t source_size, int64_t source_mtime_ns) {
+        for (auto& offsets : offsets_) offsets.clear();
+        source_size_ = source_size;
+        source_mtime_ns_ = source_mtime_ns;
+        content_hash_ = content_hash(file.data(), file.size());
+        const char* p = file.begin();
+        const char* end = file.end();
+        while (p < end) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            if (eol == nullptr) eol = end;
+            char type = log_record_type(p, eol);
+            if (type == 0) break;
+            int s = slot(type);
+            if (s >= 0 && !LegoLogfile::is_short_line(p, eol)) offsets_[s].push_back(static_cast<uint64_t>(p - file.begin()));
+            p = eol + 1;
+        }
+    }
+
+    // Loads the sidecar of a log, which is mapped as file. Returns false if
+    // it is missing, invalid or stale. The log is hashed only if its time
+    // cannot tell; a sidecar which was valid but had the wrong or a racy
+    // time is written again.
+    bool load(const std::string& filename, const MappedFile& file) {
+        uint64_t size, sidecar_size;
+        int64_t mtime_ns, sidecar_mtime_ns;
+        if (!stat_source(filename, size, mtime_ns) ||
+            !stat_source(sidecar_name(filename), sidecar_size, sidecar_mtime_ns)) {
+            return false;
+        }
+        MappedFile sidecar(sidecar_name(filename));
+        if (sidecar.size() < sizeof(LogIndexHeader)) return false;
+
+        LogIndexHeader header;
+        std::memcpy(&header, sidecar.data(), sizeof(header));
+        if (std::memcmp(header.magic, log_index_magic, sizeof(header.magic)) != 0 ||
+            header.version != log_index_version || header.source_size != size || header.type_count > 26) {
+            return false;
+        }
+        bool racy = mtime_ns > sidecar_mtime_ns - mtime_granularity_ns;
+        bool rewrite = false;
+        if (header.source_mtime_ns != mtime_ns || racy) {
+            // Same size, but the time differs or proves nothing: compare
+            // the contents.
+            if (file.size() != size || content_hash(file.data(), file.size()) != header.content_hash) return false;
+            rewrite = header.source_mtime_ns != mtime_ns || realtime_ns() - mtime_ns > mtime_granularity_ns;
+        }
+        const char* p = sidecar.data() + sizeof(header);
+        size_t remaining = sidecar.size() - sizeof(header);
+        if (remaining < header.type_count * sizeof(LogIndexEntry)) return false;
+        std::vector<LogIndexEntry> entries(header.type_count);
+        std::memcpy(entries.data(), p, entries.size() * sizeof(LogIndexEntry));
+        p += entries.size() * sizeof(LogIndexEntry);
+        remaining -= entries.size() * sizeof(LogIndexEntry);
+
+        for (auto& offsets : offsets_) offsets.clear();
+        for (const auto& entry : entries) {
+            int s = slot(static_cast<char>(entry.type));
+            if (s < 0 || remaining / sizeof(uint64_t) < entry.count) return false;
+            offsets_[s].resize(entry.count);
+            std::memcpy(offsets_[s].data(), p, entry.count * sizeof(uint64_t));
+            p += entry.count * sizeof(uint64_t);
+            remaining -= entry.count * sizeof(uint64_t);
+        }
+        source_size_ = size;
+        source_mtime_ns_ = mtime_ns;
+        content_hash_ = header.content_hash;
+        if (rewrite) save(filename);
+        return true;
+    }
+
+    // Writes the sidecar. Returns false if it cannot be written.
+    bool save(const std::string& filename) const {
+        LogIndexHeader header;
+        std::memcpy(header.magic, log_index_magic, sizeof(header.magic));
+        header.version = log_index_version;
+        header.type_count = 0;
+        header.source_size = source_size_;
+        header.source_mtime_ns = source_mtime_ns_;
+        header.content_hash = content_hash_;
+        std::vector<LogIndexEntry> entries;
+        for (int s = 0; s < 26; ++s) {
+            if (!offsets_[s].empty()) entries.push_back(LogIndexEntry{static_cast<uint32_t>('A' + s), 0, offsets_[s].size()});
+        }
+        header.type_count = static_cast<uint32_t>(entries.size());
+
+        // By way of a temporary file, so a concurrent load() never sees half
+        // a sidecar.
+        return replace_file(sidecar_name(filename), [&](const std::string& temporary) {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) return false;
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(LogIndexEntry)));
+            for (const auto& entry : entries) {
+                const auto& offsets = offsets_[slot(static_cast<char>(entry.type))];
+                file.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+            }
+            file.close();
+            return static_cast<bool>(file);
+        });
+    }
+
+    // Loads the sidecar if it is up to date, otherwise indexes the mapped
+    // log and tries to write a new sidecar. A log which is missing, or was
+    // not mapped as a whole, gets no sidecar.
+    void load_or_build(const std::string& filename, const MappedFile& file) {
+        if (load(filename, file)) return;
+        uint64_t size = 0;
+        int64_t mtime_ns = 0;
+        bool mapped = stat_source(filename, size, mtime_ns) && size == file.size();
+        build(file, file.size(), mtime_ns);
+        if (mapped) save(filename);
+    }
+};
+
+// A text log opened for random access: records are parsed only when
+// asked for, using the byte offsets of a LogIndex.
+//
+//     IndexedLogfile log("robot4_scan.txt");
+//     std::vector<int> scan = log.scan(8);
+//
+class IndexedLogfile {
+private:
+    MappedFile file_;
+    LogIndex index_;
+
+public:
+    explicit IndexedLogfile(const std::string& filename) : file_(filename) {
+        index_.load_or_build(filename, file_);
+    }
+
+    const LogIndex& index() const { return index_; }
+
+    // Number of records of a type. For M, the number of tick differences
+    // (as in LegoLogfile::motor_ticks) is count('M') - 1.
+    size_t count(char type) const { return index_.count(type); }
+
+    // The text of record n of a type, without the newline.
+    std::string_view line(char type, size_t n) const {
+        const char* first = file_.begin() + index_.offset(type, n);
+        const char* eol = static_cast<const char*>(std::memchr(first, '\n', static_cast<size_t>(file_.end() - first)));
+        return std::string_view(first, static_cast<size_t>((eol != nullptr ? eol : file_.end()) - first));
+    }
+
+    // Parses records first .. first + count - 1 of one type into log, which
+    // then holds them at positions 0 .. count - 1 of the list of that type.
+    // For M, these are the tick differences motor_ticks[first ...] that a
+    // full read would give. Other lists of log are not touched.
+    void read(LegoLogfile& log, char type, size_t first, size_t count) const {
+        size_t lines = type == 'M' ? count + 1 : count;
+        size_t last = std::min(first + lines, index_.count(type));
+        LegoLogfile::ReadState state;
+        for (size_t n = first; n < last; ++n) {
+            std::string_view text = line(type, n);
+            log.parse_line(text.data(), text.data() + text.size(), state);
+        }
+    }
+
+    // Scan n alone, as log.scan_data[n] would be after a full read.
+    std::vector<int> scan(size_t n) const {
+        LegoLogfile log;
+        read(log, 'S', n, 1);
+        if (log.scan_data.empty()) return std::vector<int>();
+        std::vector<int> scan = log.scan_data[0];
+        return scan;
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "lego_robot.h"
+
+// Export of the lists of a LegoLogfile as NumPy .npy files, one per
+// column, for analysis in Python:
+//
+//     LegoLogNpy::write(logfile, "robot4_npy");
+//
+//     ticks = np.load("robot4_npy/motor_ticks.npy", mmap_mode="r")  # N x 2
+//
+// Every file is written in one piece from a flat buffer, without
+// formatting. The header is padded to 64 bytes, so the data of a
+// memory-mapped array is aligned.
+//
+// Files (only for non-empty lists):
+//   reference_positions.npy   int32 N x 2
+//   motor_ticks.npy           int32 N x 2, differences as in motor_ticks
+//   motor_timestamps.npy      int32 N
+//   scans.npy                 int32 (uint16 for compact scans) N x beams,
+//                             if all scans have the same number of beams;
+//                             otherwise scan_ranges.npy (all ranges) and
+//                             scan_offsets.npy (int64 N + 1), as in ScanStore
+//   scan_timestamps.npy       int32 N
+//   pole_indices.npy          int32, with pole_index_offsets.npy (int64 N + 1)
+//   filtered_positions.npy    float32 N x 3 (x, y, heading)
+//   landmark_types.npy        S1 N
+//   landmarks.npy             float32 N x 3 (x, y, diameter)
+//   detected_cylinders.npy    float32 K x 2, with detected_offsets.npy (int64 N + 1)
+//
+// Variable length records (I, D) are stored like ScanStore: the values of
+// record i are values[offsets[i]:offsets[i + 1]].
+
+// NumPy type strings, little endian as on our machines.
+template <typename T> struct NpyType;
+template <> struct NpyType<char> { static constexpr const char* descr = "|S1"; };
+template <> struct NpyType<uint16_t> { static constexpr const char* descr = "<u2"; };
+template <> struct NpyType<int32_t> { static constexpr const char* descr = "<i4"; };
+template <> struct NpyType<int64_t> { static constexpr const char* descr = "<i8"; };
+template <> struct NpyType<float> { static constexpr const char* descr = "<f4"; };
+
+// Writes count values as an array of the given shape (the product of
+// shape must be count). Returns false on I/O errors.
+template <typename T>
+bool write_npy(const std::string& filename, const T* values, size_t count, const std::vector<size_t>& shape) {
+    std::string dict = std::string("{'descr': '") + NpyType<T>::descr + "', 'fortran_order': False, 'shape': (";
+    for (size_t i = 0; i < shape.size(); ++i) dict += std::to_string(shape[i]) + (shape.size() == 1 ? "," : i + 1 < shape.size() ? ", " : "");
+    dict += "), }";
+    // Magic (6), version (2) and header length (2), then the dict, padded
+    // with spaces and ended by a newline.
+    size_t header_size = (10 + dict.size() + 1 + 63) / 64 * 64;
+    dict.append(header_size - 10 - dict.size() - 1, ' ');
+    dict += '\n';
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    uint16_t dict_size = static_cast<uint16_t>(dict.size());
+    const char magic[8] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+    file.write(magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&dict_size), sizeof(dict_size));
+    file.write(dict.data(), static_cast<std::streamsize>(dict.size()));
+    file.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(count * sizeof(T)));
+    return static_cast<bool>(file);
+}
+
+// The same for a contiguous container, std::vector or std::pmr::vector.
+template <typename Container>
+bool write_npy(const std::string& filename, const Container& values, const std::vector<size_t>& shape) {
+    return write_npy(filename, values.data(), values.size(), shape);
+}
+
+// Export of a whole LegoLogfile.
+class LegoLogNpy {
+private:
+    template <typename List>
+    static std::vector<int64_t> offsets_of(const List& lists) {
+        std::vector<int64_t> offsets(1, 0);
+        offsets.reserve(lists.size() + 1);
+        for (const auto& l : lists) offsets.push_back(offsets.back() + static_cast<int64_t>(l.size()));
+        return offsets;
+    }
+
+    template <typename T>
+    static bool write_scans(const std::string& directory, const BasicScanStore<T>& scans) {
+        const auto& offsets = scans.offsets();
+        size_t count = offsets.back();
+        size_t beams = scans[0].size();
+        bool uniform = true;
+        for (size_t i = 1; i < scans.size() && uniform; ++i) uniform = offsets[i + 1] - offsets[i] == beams;
+        if (uniform) return write_npy(directory + "/scans.npy", scans.ranges().data(), count, {scans.size(), beams});
+        std::vector<int64_t> offsets64(offsets.begin(), offsets.end());
+        return write_npy(directory + "/scan_ranges.npy", scans.ranges().data(), count, {count}) &&
+               write_npy(directory + "/scan_offsets.npy", offsets64, {offsets64.size()});
+    }
+
+public:
+    // Writes the non-empty lists of the logfile into directory, which is
+    // created if needed. Returns false on I/O errors.
+    static bool write(const LegoLogfile& log, const std::string& directory) {
+        ::mkdir(directory.c_str(), 0755);
+        bool ok = true;
+
+        if (!log.reference_positions.empty()) {
+            std::vector<int32_t> values;
+            values.reserve(log.reference_positions.size() * 2);
+            for (const auto& p : log.reference_positions) {
+                values.push_back(std::get<0>(p));
+                values.push_back(std::get<1>(p));
+            }
+            ok = write_npy(directory + "/reference_positions.npy", values, {log.reference_positions.size(), 2}) && ok;
+        }
+
+        if (!log.motor_ticks.empty()) {
+            std::vector<int32_t> values;
+            values.reserve(log.motor_ticks.size() * 2);
+            for (const auto& t : log.motor_ticks) {
+                values.push_back(std::get<0>(t));
+                values.push_back(std::get<1>(t));
+            }
+            ok = write_npy(directory + "/motor_ticks.npy", values, {log.motor_ticks.size(), 2}) && ok;
+        }
+        if (!log.motor_timestamps.empty()) {
+            ok = write_npy(directory + "/motor_timestamps.npy", log.motor_timestamps, {log.motor_timestamps.size()}) && ok;
+        }
+
+        if (!log.scan_data.empty()) {
+            ok = write_scans(directory, log.scan_data) && ok;
+        } else if (!log.compact_scan_data.empty()) {
+            ok = write_scans(directory, log.compact_scan_data) && ok;
+        }
+        if (!log.scan_timestamps.empty()) {
+            ok = write_npy(directory + "/scan_timestamps.npy", log.scan_timestamps, {log.scan_timestamps.size()}) && ok;
+        }
+
+        if (!log.pole_indices.empty()) {
+            std::vector<int32_t> values;
+            for (const auto& indices : log.pole_indices) values.insert(values.end(), indices.begin(), indices.end());
+            std::vector<int64_t> offsets = offsets_of(log.pole_indices);
+            ok = write_npy(directory + "/pole_indices.npy", values, {values.size()}) && ok;
+            ok = write_npy(directory + "/pole_index_offsets.npy", offsets, {offsets.size()}) && ok;
+        }
+
+        if (!log.filtered_positions.empty()) {
+            std::vector<float> values;
+            values.reserve(log.filtered_positions.size() * 3);
+            for (const auto& f : log.filtered_positions) {
+                values.push_back(std::get<0>(f));
+                values.push_back(std::get<1>(f));
+                values.push_back(std::get<2>(f));
+            }
+            ok = write_npy(directory + "/filtered_positions.npy", values, {log.filtered_positions.size(), 3}) && ok;
+        }
+
+        if (!log.landmarks.empty()) {
+            std::vector<char> types;
+            std::vector<float> values;
+            for (const auto& l : log.landmarks) {
+                types.push_back(std::get<0>(l));
+                values.push_back(std::get<1>(l));
+                values.push_back(std::get<2>(l));
+                values.push_back(std::get<3>(l));
+            }
+            ok = write_npy(directory + "/landmark_types.npy", types, {types.size()}) && ok;
+            ok = write_npy(directory + "/landmarks.npy", values, {log.landmarks.size(), 3}) && ok;
+        }
+
+        if (!log.detected_cylinders.empty()) {
+            std::vector<float> values;
+            for (const auto& cylinders : log.detected_cylinders) {
+                for (const auto& c : cylinders) {
+                    values.push_back(std::get<0>(c));
+                    values.push_back(std::get<1>(c));
+                }
+            }
+            std::vector<int64_t> offsets = offsets_of(log.detected_cylinders);
+            ok = write_npy(directory + "/detected_cylinders.npy", values, {values.size() / 2, 2}) && ok;
+            ok = write_npy(directory + "/detected_offsets.npy", offsets, {offsets.size()}) && ok;
+        }
+        return ok;
+    }
+};
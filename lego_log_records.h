@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lego_robot.h"
+#include "mapped_file.h"
+
+// Record types beyond the ones LegoLogfile knows (P, S, I, M, F, L, D),
+// declared where they are used instead of in lego_robot.h. A record type
+// is a type with
+//   static constexpr char tag;       the first character of its lines
+//   using value_type = ...;          what one line is stored as
+//   static int min_fields();         fields a line needs after the tag
+//   static LogLineError parse(LogLineCursor& cursor, value_type& value);
+// Lines with fewer fields are skipped, like short lines of the built-in
+// types. LogRecordType gives all four for lines which are just a tag
+// followed by fixed int / float fields:
+//
+//     struct ImuRecord : LogRecordType<'U', int, float, float, float> {};  // timestamp, gyro z, accel x, y
+//     struct BatteryRecord : LogRecordType<'V', int, float> {};            // timestamp, volts
+//     struct BumperRecord : LogRecordType<'B', int, int> {};               // timestamp, pressed
+//
+//     ExtendedLogfile<ImuRecord, BatteryRecord, BumperRecord> log;
+//     log.read_mapped("robot4_imu.txt");
+//     for (const auto& imu : log.records<ImuRecord>()) { ... }
+//
+template <char Tag, typename... Fields>
+struct LogRecordType {
+    static_assert(((std::is_same<Fields, int>::value || std::is_same<Fields, float>::value) && ...),
+                  "LogRecordType fields must be int or float");
+
+    static constexpr char tag = Tag;
+    using value_type = std::tuple<Fields...>;
+
+    static int min_fields() { return sizeof...(Fields); }
+
+    // Reads the fields after the tag. Fields beyond the last are ignored.
+    static LogLineError parse(LogLineCursor& cursor, value_type& value) {
+        std::apply([&](auto&... field) { (read_field(cursor, field), ...); }, value);
+        return cursor.error();
+    }
+
+private:
+    static void read_field(LogLineCursor& cursor, int& field) { field = cursor.int_field(); }
+    static void read_field(LogLineCursor& cursor, float& field) { field = cursor.float_field(); }
+};
+
+// A LegoLogfile which also stores the record types Records, one list per
+// type. Every read goes through one RecordRegistry made of the built-in
+// handlers followed by one for each of Records, so the dispatch is unrolled
+// at compile time and types which are not listed cost nothing. The lists
+// merge across read calls like the built-in ones: the first record of a
+// type replaces the list.
+//
+// The LegoLogfile base is private, because its own read functions only
+// know the built-in types: read_parallel() and read_files() are not
+// available, and the built-in lists are reached through builtin(), e.g.
+// LegoLogWriter::write(log.builtin(), ...), which cannot read.
+template <typename... Records>
+class ExtendedLogfile : private LegoLogfile {
+    template <typename...>
+    friend struct RecordRegistry;
+    template <typename>
+    friend class BasicLogRecordParser;
+
+private:
+    // The handler of Records[I], storing into lists_.
+    template <size_t I>
+    struct ExtraRecord {
+        using Record = std::tuple_element_t<I, std::tuple<Records...>>;
+        static constexpr char tag = Record::tag;
+        static int min_fields() { return Record::min_fields(); }
+        static void clear(ExtendedLogfile& log) { std::get<I>(log.lists_).clear(); }
+        static LogLineError parse(ExtendedLogfile& log, LogLineCursor& cursor, ReadState&) {
+            typename Record::value_type value{};
+            LogLineError error = Record::parse(cursor, value);
+            if (error == LogLineError::None) std::get<I>(log.lists_).push_back(std::move(value));
+            return error;
+        }
+        // The value is read with BasicLogRecordParser::value<Record>().
+        static bool view(const ExtendedLogfile&, LogLineCursor, LogRecord&) { return true; }
+    };
+
+    template <size_t... I>
+    static typename BuiltinRecords::template with<ExtraRecord<I>...> registry(std::index_sequence<I...>);
+    using AllRecords = decltype(registry(std::index_sequence_for<Records...>()));
+    using Registry = AllRecords;
+
+    std::tuple<std::pmr::vector<typename Records::value_type>...> lists_;
+
+    template <typename Record, size_t I = 0>
+    static constexpr size_t index_of() {
+        static_assert(I < sizeof...(Records), "record type is not part of this ExtendedLogfile");
+        if constexpr (std::is_same<Record, std::tuple_element_t<I, std::tuple<Records...>>>::value) {
+            return I;
+        } else {
+            return index_of<Record, I + 1>();
+        }
+    }
+
+    template <size_t... I>
+    void add_footprints([[maybe_unused]] std::vector<RecordFootprint>& result, std::index_sequence<I...>) const {
+        (..., [&] {
+            RecordFootprint f{Records::tag};
+            f.records = std::get<I>(lists_).size();
+            f.add(std::get<I>(lists_));
+            result.push_back(f);
+        }());
+    }
+
+    LogLineError try_parse_line(const char* first, const char* last, ReadState& state) {
+        return parse_record_line<AllRecords>(*this, first, last, state);
+    }
+
+    void parse_file(const MappedFile& file, ReadState& state) {
+        parse_range(file.begin(), file.end(), state, [this](const char* first, const char* last, char, ReadState& s) {
+            return try_parse_line(first, last, s);
+        });
+    }
+
+public:
+    // All lists, the extra ones too, allocate from resource (see LegoLogfile).
+    explicit ExtendedLogfile(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : LegoLogfile(resource), lists_(std::pmr::vector<typename Records::value_type>(resource)...) {}
+
+    using LegoLogfile::motor_ticks;
+    using LegoLogfile::scan_data;
+    using LegoLogfile::motor_timestamps;
+    using LegoLogfile::scan_timestamps;
+    using LegoLogfile::motor_start_timestamp;
+    using LegoLogfile::compact_scans;
+    using LegoLogfile::compact_scan_data;
+    using LegoLogfile::size;
+    using LegoLogfile::beam_index_to_angle;
+
+    // The built-in record types, for code which takes a LegoLogfile.
+    const LegoLogfile& builtin() const { return *this; }
+
+    // The list of a record type.
+    template <typename Record>
+    std::pmr::vector<typename Record::value_type>& records() { return std::get<index_of<Record>()>(lists_); }
+
+    template <typename Record>
+    const std::pmr::vector<typename Record::value_type>& records() const { return std::get<index_of<Record>()>(lists_); }
+
+    // As LegoLogfile::read(), for the built-in and the extra types.
+    void read(const std::string& filename) {
+        std::ifstream file(filename);
+        read_lines(file, [this](const char* first, const char* last, ReadState& state) {
+            return try_parse_line(first, last, state);
+        });
+    }
+
+    // As LegoLogfile::read_mapped(), for the built-in and the extra types.
+    void read_mapped(const std::string& filename, RecordSet wanted = RecordSet::all()) {
+        MappedFile file(filename);
+        ReadState state;
+        state.wanted = wanted;
+        parse_file(file, state);
+    }
+
+    // As LegoLogfile::read_robust(), for the built-in and the extra types.
+    ParseStats read_robust(const std::string& filename, RecordSet wanted = RecordSet::all()) {
+        auto start = std::chrono::steady_clock::now();
+        ParseStats stats;
+        MappedFile file(filename);
+        ReadState state;
+        state.wanted = wanted;
+        state.stats = &stats;
+        parse_file(file, state);
+        stats.bytes = file.size();
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    // As LegoLogfile::footprint(), followed by the extra types.
+    std::vector<RecordFootprint> footprint() const {
+        std::vector<RecordFootprint> result = LegoLogfile::footprint();
+        add_footprints(result, std::index_sequence_for<Records...>());
+        return result;
+    }
+
+    using LegoLogfile::info;
+    std::string info() const { return info(footprint()); }
+
+    bool operator==(const ExtendedLogfile& other) const {
+        return builtin() == other.builtin() && lists_ == other.lists_;
+    }
+
+    bool operator!=(const ExtendedLogfile& other) const { return !(*this == other); }
+};
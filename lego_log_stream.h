@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "lego_robot.h"
+#include "scan_store.h"
+
+// Turns log lines into LogRecords, with the handlers of the record types
+// of Log (a LegoLogfile, or an ExtendedLogfile for extra types): each line
+// is parsed into a logfile that holds only that line's record, and the
+// LogRecord views it. Keeps the state that spans lines: the previous M
+// record, to compute tick differences.
+template <typename Log>
+class BasicLogRecordParser {
+private:
+    Log log_;
+    LegoLogfile::ReadState state_;
+    LogRecord record_;
+
+public:
+    // Parses one non-blank line. Returns false for lines which do not yield
+    // a record (unknown type, too few fields, or the first M record). A
+    // malformed line throws, as in LegoLogfile::read_mapped().
+    bool parse(const char* first, const char* last) {
+        bool has_record = false;
+        LogLineError error = try_parse(first, last, has_record);
+        if (error != LogLineError::None && error != LogLineError::TooFewFields) throw_log_line_error(error);
+        return has_record;
+    }
+
+    // Same, but returns the error of a malformed or short line instead of
+    // throwing.
+    LogLineError try_parse(const char* first, const char* last, bool& has_record) {
+        has_record = false;
+        state_.seen = RecordSet::none(); // So the line replaces the record before
+        LogLineError error = log_.try_parse_line(first, last, state_);
+        if (error != LogLineError::None) return error;
+        LogLineCursor cursor(first, last);
+        std::string_view record_type = cursor.next();
+        if (record_type.empty()) return LogLineError::None;
+        record_.type = record_type[0];
+        has_record = Log::Registry::view(record_.type, log_, cursor, record_);
+        return LogLineError::None;
+    }
+
+    // The record found by the last successful parse().
+    const LogRecord& record() const { return record_; }
+
+    // The value of an extra record type of an ExtendedLogfile, after
+    // parse() found a record of that type.
+    template <typename Record>
+    const typename Record::value_type& value() const { return log_.template records<Record>().front(); }
+
+    // Forgets the previous M record, e.g. when a log starts over.
+    void reset() { state_.have_last_ticks = false; }
+
+    // If set, S records give their ranges as 16 bit values in
+    // record().compact_scan, as LegoLogfile::compact_scans does.
+    void set_compact_scans(bool compact) { log_.compact_scans = compact; }
+};
+
+using LogRecordParser = BasicLogRecordParser<LegoLogfile>;
+
+// Reads a log one record at a time, with memory bounded by the longest
+// line, no matter how long the log is. Records come out in file order and
+// with the same contents LegoLogfile::read() would store, since they are
+// parsed by the same handlers: M records are turned into tick differences
+// (so the first M record yields nothing), and a blank line ends the log.
+//
+//     LegoLogReader reader("robot4_scan.txt");
+//     for (const LogRecord& record : reader) { ... }
+//
+// For the extra types of an ExtendedLogfile, read with
+// BasicLegoLogReader<ExtendedLogfile<...>>, and get the value of a record
+// of such a type with value<Record>().
+template <typename Log>
+class BasicLegoLogReader {
+private:
+    static const size_t chunk_size = 1 << 20;
+
+    std::ifstream file_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0;   // Start of the unparsed part of buffer_
+    size_t end_ = 0;     // End of the valid part of buffer_
+    bool eof_ = false;
+    bool done_ = false;
+    BasicLogRecordParser<Log> parser_;
+    RecordSet wanted_;
+
+    // Finds the next complete line, reading more of the file as needed.
+    // Returns false at the end of the file.
+    bool next_line(const char*& first, const char*& last) {
+        size_t search_from = begin_;
+        for (;;) {
+            const char* data = buffer_.data();
+            const void* eol = std::memchr(data + search_from, '\n', end_ - search_from);
+            if (eol != nullptr) {
+                first = data + begin_;
+                last = static_cast<const char*>(eol);
+                begin_ = static_cast<size_t>(last - data) + 1;
+                return true;
+            }
+            if (eof_) {
+                // The last line may lack its newline.
+                if (begin_ == end_) return false;
+                first = data + begin_;
+                last = data + end_;
+                begin_ = end_;
+                return true;
+            }
+            // Keep the partial line, and make room for the next chunk.
+            search_from = end_ - begin_;
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+            if (buffer_.size() - end_ < chunk_size) buffer_.resize(end_ + chunk_size);
+            file_.read(buffer_.data() + end_, static_cast<std::streamsize>(buffer_.size() - end_));
+            std::streamsize got = file_.gcount();
+            if (got <= 0) eof_ = true;
+            end_ += static_cast<size_t>(got > 0 ? got : 0);
+        }
+    }
+
+public:
+    class iterator {
+    private:
+        BasicLegoLogReader* reader_;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = LogRecord;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const LogRecord*;
+        using reference = const LogRecord&;
+
+        explicit iterator(BasicLegoLogReader* reader) : reader_(reader) {}
+        const LogRecord& operator*() const { return reader_->record(); }
+        const LogRecord* operator->() const { return &reader_->record(); }
+        iterator& operator++() {
+            if (!reader_->next()) reader_ = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return reader_ == other.reader_; }
+        bool operator!=(const iterator& other) const { return reader_ != other.reader_; }
+    };
+
+    // Only records of the wanted types are parsed and returned.
+    explicit BasicLegoLogReader(const std::string& filename, RecordSet wanted = RecordSet::all())
+        : file_(filename, std::ios::binary), buffer_(chunk_size), wanted_(wanted) {
+        if (!file_.is_open()) done_ = true;
+    }
+
+    bool is_open() const { return file_.is_open(); }
+
+    // If set, S records give their ranges in record.compact_scan (16 bit)
+    // instead of record.scan. Call before reading.
+    void set_compact_scans(bool compact) { parser_.set_compact_scans(compact); }
+
+    // Advances to the next record. Returns false at the end of the log.
+    bool next() {
+        const char* first;
+        const char* last;
+        while (!done_ && next_line(first, last)) {
+            char type = log_record_type(first, last);
+            if (type == 0) break; // A blank line ends the log, as in read().
+            if (wanted_.contains(type) && parser_.parse(first, last)) return true;
+        }
+        done_ = true;
+        return false;
+    }
+
+    // The record found by the last successful next().
+    const LogRecord& record() const { return parser_.record(); }
+
+    // The value of the last record, if it is of the extra type Record.
+    template <typename Record>
+    const typename Record::value_type& value() const { return parser_.template value<Record>(); }
+
+    // Calls f(record) for every remaining record.
+    template <typename Function>
+    void for_each(Function f) {
+        while (next()) f(parser_.record());
+    }
+
+    iterator begin() { return next() ? iterator(this) : iterator(nullptr); }
+    iterator end() { return iterator(nullptr); }
+};
+
+using LegoLogReader = BasicLegoLogReader<LegoLogfile>;
+
+// Follows a log that is still being written, like tail -f. Each poll()
+// parses only the complete lines appended since the previous poll, and
+// passes their records to a callback; a line still being written is kept
+// for the next poll. The tick state of M records carries over between
+// polls, so the records are the same as a LegoLogReader would give on the
+// finished log. Unlike a full read, blank lines are skipped rather than
+// ending the log, and a malformed line is skipped and counted instead of
+// throwing. If the file shrinks (truncated or replaced), it is followed
+// again from the start.
+//
+//     LegoLogFollower follower("robot4_motors.txt", RecordSet("M"));
+//     for (;;) {
+//         if (follower.poll([&](const LogRecord& record) { ... }) == 0) sleep(...);
+//     }
+//
+// Log as for BasicLegoLogReader.
+template <typename Log>
+class BasicLegoLogFollower {
+private:
+    static const size_t chunk_size = 1 << 20;
+
+    std::string filename_;
+    RecordSet wanted_;
+    uint64_t position_ = 0;     // Bytes of the file read so far
+    std::vector<char> pending_; // Read, but not yet parsed (incomplete line)
+    BasicLogRecordParser<Log> parser_;
+    size_t skipped_lines_ = 0;
+
+public:
+    explicit BasicLegoLogFollower(const std::string& filename, RecordSet wanted = RecordSet::all())
+        : filename_(filename), wanted_(wanted) {}
+
+    // Bytes of the file consumed so far.
+    uint64_t position() const { return position_; }
+
+    // Number of malformed and short lines skipped so far.
+    size_t skipped_lines() const { return skipped_lines_; }
+
+    // As for BasicLegoLogReader.
+    void set_compact_scans(bool compact) { parser_.set_compact_scans(compact); }
+
+    // Calls f(record) for every record appended since the last poll.
+    // Returns the number of records delivered.
+    template <typename Function>
+    size_t poll(Function f) {
+        struct stat st;
+        if (::stat(filename_.c_str(), &st) != 0) return 0;
+        uint64_t size = static_cast<uint64_t>(st.st_size);
+        if (size < position_) {
+            position_ = 0;
+            pending_.clear();
+            parser_.reset();
+        }
+        if (size == position_) return 0;
+
+        std::ifstream file(filename_, std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(position_));
+        size_t records = 0;
+        while (position_ < size) {
+            size_t old_size = pending_.size();
+            size_t want = static_cast<size_t>(std::min<uint64_t>(chunk_size, size - position_));
+            pending_.resize(old_size + want);
+            file.read(pending_.data() + old_size, static_cast<std::streamsize>(want));
+            size_t got = static_cast<size_t>(std::max<std::streamsize>(file.gcount(), 0));
+            pending_.resize(old_size + got);
+            if (got == 0) break;
+            position_ += got;
+
+            // Parse the complete lines, keep the incomplete last one.
+            const char* p = pending_.data();
+            const char* end = p + pending_.size();
+            for (;;) {
+                const char* eol = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+                if (eol == nullptr) break;
+                char type = log_record_type(p, eol);
+                if (type != 0 && wanted_.contains(type)) {
+                    bool has_record = false;
+                    if (parser_.try_parse(p, eol, has_record) != LogLineError::None) ++skipped_lines_;
+                    if (has_record) {
+                        f(parser_.record());
+                        ++records;
+                    }
+                }
+                p = eol + 1;
+            }
+            pending_.erase(pending_.begin(), pending_.begin() + (p - pending_.data()));
+        }
+        return records;
+    }
+};
+
+using LegoLogFollower = BasicLegoLogFollower<LegoLogfile>;
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lego_robot.h"
+
+// Writes log records in the text format LegoLogfile reads.
+// Records are formatted with std::to_chars into a large buffer, which goes
+// to the file in one write when full, so writing costs no flush per line.
+// Floating point values are written like an ostream with default settings
+// (6 significant digits) unless set_precision() says otherwise.
+//
+//     LegoLogWriter out("cylinders.txt");
+//     out.detected_cylinders(cylinders);
+//
+class LegoLogWriter {
+private:
+    static const size_t buffer_size = 1 << 20;
+    static const size_t max_field = 64; // Longest formatted number
+
+    int fd_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    int precision_ = 6;
+    bool good_;
+
+    // Makes sure there is room for n more bytes.
+    char* reserve(size_t n) {
+        if (buffer_.size() - used_ < n) {
+            flush();
+            if (buffer_.size() < n) buffer_.resize(n);
+        }
+        return buffer_.data() + used_;
+    }
+
+    void put(char c) {
+        *reserve(1) = c;
+        ++used_;
+    }
+
+    void put(const char* s) {
+        size_t n = std::strlen(s);
+        std::memcpy(reserve(n), s, n);
+        used_ += n;
+    }
+
+    void put_number(int value) {
+        char* first = reserve(max_field);
+        used_ += static_cast<size_t>(std::to_chars(first, first + max_field, value).ptr - first);
+    }
+
+    template <typename Real>
+    void put_real(Real value) {
+        char* first = reserve(max_field);
+        std::to_chars_result result = precision_ > 0
+            ? std::to_chars(first, first + max_field, value, std::chars_format::general, precision_)
+            : std::to_chars(first, first + max_field, value);
+        used_ += static_cast<size_t>(result.ptr - first);
+    }
+
+    void put_number(float value) { put_real(value); }
+    void put_number(double value) { put_real(value); }
+
+    // Writes " value" for each value.
+    template <typename... Values>
+    void put_fields(Values... values) {
+        ((put(' '), put_number(values)), ...);
+    }
+
+public:
+    explicit LegoLogWriter(const std::string& filename)
+        : fd_(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)), buffer_(buffer_size), good_(fd_ >= 0) {}
+
+    LegoLogWriter(const LegoLogWriter&) = delete;
+    LegoLogWriter& operator=(const LegoLogWriter&) = delete;
+
+    ~LegoLogWriter() { close(); }
+
+    // False if the file could not be opened or a write failed.
+    bool good() const { return good_; }
+    bool is_open() const { return fd_ >= 0; }
+
+    // Significant digits of floating point values. 0 writes the shortest
+    // text that reads back to the same value.
+    void set_precision(int digits) { precision_ = digits; }
+
+    // Writes the buffered records to the file. A write interrupted by a
+    // signal is retried.
+    void flush() {
+        const char* p = buffer_.data();
+        while (used_ > 0 && fd_ >= 0) {
+            ssize_t n = ::write(fd_, p, used_);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                good_ = false;
+                break;
+            }
+            p += n;
+            used_ -= static_cast<size_t>(n);
+        }
+        used_ = 0;
+    }
+
+    void close() {
+        if (fd_ < 0) return;
+        flush();
+        if (::close(fd_) != 0) good_ = false;
+        fd_ = -1;
+    }
+
+    // P timestamp x y
+    void reference_position(int timestamp, int x, int y) {
+        put('P');
+        put_fields(timestamp, x, y);
+        put('\n');
+    }
+
+    // S timestamp [count] range ... (count if s_record_has_count is set)
+    template <typename Scan>
+    void scan(int timestamp, const Scan& ranges) {
+        put('S');
+        put_fields(timestamp);
+        if (s_record_has_count) put_fields(static_cast<int>(ranges.size()));
+        for (const auto& r : ranges) put_fields(static_cast<int>(r));
+        put('\n');
+    }
+
+    // I timestamp index ...
+    template <typename Indices>
+    void pole_indices(int timestamp, const Indices& indices) {
+        put('I');
+        put_fields(timestamp);
+        for (const auto& i : indices) put_fields(static_cast<int>(i));
+        put('\n');
+    }
+
+    // M timestamp left 0 0 0 right, with the absolute tick counts. The
+    // reader turns consecutive M records into differences.
+    void motor_ticks(int timestamp, int left_ticks, int right_ticks) {
+        put('M');
+        put_fields(timestamp, left_ticks, 0, 0, 0, right_ticks);
+        put('\n');
+    }
+
+    // F x y [heading]
+    void filtered_position(double x, double y) {
+        put('F');
+        put_fields(x, y);
+        put('\n');
+    }
+
+    void filtered_position(double x, double y, double heading) {
+        put('F');
+        put_fields(x, y, heading);
+        put('\n');
+    }
+
+    // L type x y diameter
+    void landmark(char type, double x, double y, double diameter) {
+        put('L');
+        put(' ');
+        put(type);
+        put_fields(x, y, diameter);
+        put('\n');
+    }
+
+    // D C x y x y ... for a list of (x, y) pairs, in the layout our tools
+    // have always written (including the space after each value).
+    template <typename Cylinders>
+    void detected_cylinders(const Cylinders& cylinders) {
+        put("D C ");
+        for (const auto& c : cylinders) {
+            put_number(std::get<0>(c));
+            put(' ');
+            put_number(std::get<1>(c));
+            put(' ');
+        }
+        put('\n');
+    }
+
+    // Writes all lists of a logfile, one record per line, interleaved by
+    // index. Motor ticks are written as running sums starting at 0, from
+    // an M record at motor_start_timestamp, and missing timestamps as 0.
+    // With precision 0, reading the file back gives the same logfile.
+    void write(const LegoLogfile& log) {
+        for (size_t i = 0; i < log.landmarks.size(); ++i) {
+            const auto& l = log.landmarks[i];
+            put('L');
+            put(' ');
+            put(std::get<0>(l));
+            put_fields(std::get<1>(l), std::get<2>(l), std::get<3>(l));
+            put('\n');
+        }
+        auto motor_time = [&](size_t i) { return i < log.motor_timestamps.size() ? log.motor_timestamps[i] : 0; };
+        auto scan_time = [&](size_t i) { return i < log.scan_timestamps.size() ? log.scan_timestamps[i] : 0; };
+        int left = 0, right = 0;
+        if (!log.motor_ticks.empty()) motor_ticks(log.motor_start_timestamp, left, right);
+        for (size_t i = 0; i < log.size(); ++i) {
+            if (i < log.reference_positions.size()) {
+                reference_position(0, std::get<0>(log.reference_positions[i]), std::get<1>(log.reference_positions[i]));
+            }
+            if (i < log.motor_ticks.size()) {
+                left += std::get<0>(log.motor_ticks[i]);
+                right += std::get<1>(log.motor_ticks[i]);
+                motor_ticks(motor_time(i), left, right);
+            }
+            if (i < log.scan_data.size()) scan(scan_time(i), log.scan_data[i]);
+            if (i < log.compact_scan_data.size()) scan(scan_time(i), log.compact_scan_data[i]);
+            if (i < log.pole_indices.size()) pole_indices(0, log.pole_indices[i]);
+            if (i < log.filtered_positions.size()) {
+                const auto& f = log.filtered_positions[i];
+                put('F');
+                put_fields(std::get<0>(f), std::get<1>(f), std::get<2>(f));
+                put('\n');
+            }
+            if (i < log.detected_cylinders.size()) detected_cylinders(log.detected_cylinders[i]);
+        }
+    }
+};
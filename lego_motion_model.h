@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cmath>
+#include <tuple>
+#include <utility>
+
+// Motion model of our Lego robot: from the old pose (x, y, heading) and the
+// motor ticks of one step (left, right), computes the new pose.
+//
+//     MotionModel<double> model(0.349, 150.0);                // ticks_to_mm, robot_width
+//     pose = model.step(pose, std::make_pair(left, right));
+//
+// Scalar is the type of the arithmetic (float, double or long double).
+// Offset says where the tracked pose is: NoScannerOffset for the center of
+// the robot, ScannerOffset for the scanner, which sits `displacement` mm
+// ahead of the center on the robot's axis:
+//
+//     MotionModel<double, ScannerOffset<double>> model(0.349, 150.0, ScannerOffset<double>(30.0));
+//
+// NoScannerOffset is empty and its conversions do nothing, so the model
+// without offset costs nothing for it.
+
+// The tracked pose is the center of the robot.
+struct NoScannerOffset {
+    template <typename Scalar>
+    void to_center(Scalar&, Scalar&, Scalar) const {}
+    template <typename Scalar>
+    void from_center(Scalar&, Scalar&, Scalar) const {}
+    template <typename Scalar>
+    void relative_from_center(Scalar&, Scalar&, Scalar) const {}
+};
+
+// The tracked pose is the scanner's, displacement ahead of the center.
+template <typename Scalar>
+struct ScannerOffset {
+    Scalar displacement;
+
+    explicit ScannerOffset(Scalar displacement) : displacement(displacement) {}
+
+    void to_center(Scalar& x, Scalar& y, Scalar theta) const {
+        x = x - displacement * std::cos(theta);
+        y = y - displacement * std::sin(theta);
+    }
+    void from_center(Scalar& x, Scalar& y, Scalar theta) const {
+        x = x + displacement * std::cos(theta);
+        y = y + displacement * std::sin(theta);
+    }
+    // Turns a motion (dx, dy, alpha) of the center, in the center's frame,
+    // into that of the scanner, in the scanner's frame.
+    void relative_from_center(Scalar& dx, Scalar& dy, Scalar alpha) const {
+        Scalar half = std::sin(alpha / 2);
+        dx = dx - 2 * displacement * half * half; // d (cos(alpha) - 1)
+        dy = dy + displacement * std::sin(alpha);
+    }
+};
+
+template <typename Scalar = double, typename Offset = NoScannerOffset>
+class MotionModel {
+private:
+    Scalar ticks_to_mm_;
+    Scalar robot_width_;
+    Offset offset_;
+
+public:
+    using Pose = std::tuple<Scalar, Scalar, Scalar>;
+
+    static constexpr Scalar pi = static_cast<Scalar>(3.141592653589793238462643383279502884L);
+
+    MotionModel(Scalar ticks_to_mm, Scalar robot_width, Offset offset = Offset())
+        : ticks_to_mm_(ticks_to_mm), robot_width_(robot_width), offset_(offset) {}
+
+    Scalar ticks_to_mm() const { return ticks_to_mm_; }
+    Scalar robot_width() const { return robot_width_; }
+    const Offset& offset() const { return offset_; }
+
+    // The pose after driving motor_ticks (left, right) from old_pose.
+    Pose step(const Pose& old_pose, const std::pair<int, int>& motor_ticks) const {
+        Scalar old_x, old_y, old_theta;
+        std::tie(old_x, old_y, old_theta) = old_pose;
+
+        // Find out if there is a turn at all.
+        if (motor_ticks.first == motor_ticks.second) {
+            // No turn. Just drive straight.
+            Scalar x = old_x + motor_ticks.first * ticks_to_mm_ * std::cos(old_theta);
+            Scalar y = old_y + motor_ticks.first * ticks_to_mm_ * std::sin(old_theta);
+            return Pose(x, y, old_theta);
+        }
+
+        // Turn. The turn is about the center of the robot, so move the
+        // old pose there first.
+        offset_.to_center(old_x, old_y, old_theta);
+
+        // alpha = (r-l)/w, R = l/alpha
+        Scalar alpha = (motor_ticks.second - motor_ticks.first) * ticks_to_mm_ / robot_width_;
+        Scalar R = motor_ticks.first * ticks_to_mm_ / alpha;
+
+        Scalar x_center = old_x - (R + robot_width_ / 2) * std::sin(old_theta);
+        Scalar y_center = old_y + (R + robot_width_ / 2) * std::cos(old_theta);
+
+        Scalar theta = std::fmod(old_theta + alpha, 2 * pi);
+        Scalar x = x_center + (R + robot_width_ / 2) * std::sin(theta);
+        Scalar y = y_center - (R + robot_width_ / 2) * std::cos(theta);
+
+        offset_.from_center(x, y, theta);
+        return Pose(x, y, theta);
+    }
+
+    // The motion of one step as a rigid transform (dx, dy, dtheta) in the
+    // frame of the old pose. It does not depend on the old pose, so the
+    // transforms of consecutive steps can be composed in any grouping (see
+    // lego_dead_reckoning.h).
+    Pose relative(const std::pair<int, int>& motor_ticks) const {
+        return motion(motor_ticks.first * ticks_to_mm_, motor_ticks.second * ticks_to_mm_);
+    }
+
+    // As relative(), for the distances (in mm) the left and right wheel
+    // drove, which need not be whole ticks (e.g. with sampled noise, see
+    // lego_particle_filter.h). Nearly straight motions lose no precision.
+    Pose motion(Scalar left, Scalar right) const {
+        if (left == right) {
+            return Pose(left, Scalar(0), Scalar(0));
+        }
+        Scalar alpha = (right - left) / robot_width_;
+        Scalar R = left / alpha;
+        Scalar dx = (R + robot_width_ / 2) * std::sin(alpha);
+        Scalar half = std::sin(alpha / 2);
+        Scalar dy = (R + robot_width_ / 2) * 2 * half * half; // 1 - cos(alpha), without cancellation
+        offset_.relative_from_center(dx, dy, alpha);
+        return Pose(dx, dy, alpha);
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+#include "lego_batch_odometry.h"
+#include "lego_dead_reckoning.h"
+#include "lego_motion_model.h"
+#include "parallel_for.h"
+
+// Prediction step of a particle filter: every particle drives the motor
+// ticks of one step with its own sampled control noise.
+//
+//     PoseBatch particles;
+//     particles.assign(100000, start, 0.349, 150.0);
+//     ParticlePrediction predict(ControlNoise(), 30.0, 1);  // scanner displacement, seed
+//     for (const auto& t : logfile.motor_ticks) predict(particles, std::get<0>(t), std::get<1>(t));
+//
+// Particles are a PoseBatch, each with its own ticks_to_mm and robot_width.
+// The noisy wheel distances of a particle have a standard deviation of
+//
+//     sigma_left  = sqrt((motion_factor * left)^2 + (turn_factor * (left - right))^2)
+//     sigma_right = sqrt((motion_factor * right)^2 + (turn_factor * (left - right))^2)
+//
+// in mm, and the particle then moves as MotionModel::motion() says.
+//
+// The noise comes from a counter-based generator (Philox4x32-10): the two
+// normal samples of particle i in step k are a function of (seed, i, k)
+// alone. So the particles are the same for any number of threads and any
+// block split, and a run can be repeated exactly from its seed. Particles
+// are predicted in blocks of block_size on a ThreadPool, by default the
+// shared one, so the threads are started once and not in every step.
+
+// One Philox4x32-10 block: four random 32 bit words for a 128 bit counter
+// under a 64 bit key (Salmon et al., "Parallel random numbers: as easy as
+// 1, 2, 3", 2011).
+inline void philox4x32(uint32_t counter[4], uint32_t key0, uint32_t key1) {
+    for (int round = 0; round < 10; ++round) {
+        uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * counter[0];
+        uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * counter[2];
+        uint32_t c0 = static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key0;
+        uint32_t c2 = static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key1;
+        counter[0] = c0;
+        counter[1] = static_cast<uint32_t>(p1);
+        counter[2] = c2;
+        counter[3] = static_cast<uint32_t>(p0);
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+}
+
+// Two independent standard normal samples for (seed, stream, step).
+inline std::pair<double, double> philox_normal_pair(uint64_t seed, uint64_t stream, uint64_t step) {
+    uint32_t c[4] = {static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32),
+                     static_cast<uint32_t>(step), static_cast<uint32_t>(step >> 32)};
+    philox4x32(c, static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32));
+    // 53 bit uniforms, u1 in (0, 1] so that its log is finite.
+    const double scale = 1.0 / 9007199254740992.0; // 2^-53
+    uint64_t a = (static_cast<uint64_t>(c[0]) << 32 | c[1]) >> 11;
+    uint64_t b = (static_cast<uint64_t>(c[2]) << 32 | c[3]) >> 11;
+    double u1 = (static_cast<double>(a) + 1.0) * scale;
+    double u2 = static_cast<double>(b) * scale;
+    // Box-Muller.
+    const double twopi = 2 * MotionModel<double>::pi;
+    double r = std::sqrt(-2.0 * std::log(u1));
+    return std::make_pair(r * std::cos(twopi * u2), r * std::sin(twopi * u2));
+}
+
+struct ControlNoise {
+    double motion_factor = 0.35; // Sigma per mm a wheel drove
+    double turn_factor = 0.6;    // Sigma per mm the wheels differ
+};
+
+class ParticlePrediction {
+private:
+    ControlNoise noise_;
+    double scanner_displacement_;
+    uint64_t seed_;
+    uint64_t step_ = 0;
+    ThreadPool* pool_;
+
+public:
+    static constexpr size_t block_size = 4096;
+
+    // The pool must outlive the prediction.
+    explicit ParticlePrediction(const ControlNoise& noise = ControlNoise(), double scanner_displacement = 0.0,
+                                uint64_t seed = 0, ThreadPool& pool = shared_thread_pool())
+        : noise_(noise), scanner_displacement_(scanner_displacement), seed_(seed), pool_(&pool) {}
+
+    const ControlNoise& noise() const { return noise_; }
+    uint64_t seed() const { return seed_; }
+    // Steps predicted so far; the next one draws the noise of this step.
+    uint64_t steps() const { return step_; }
+
+    // Moves every particle by the motor ticks (left, right) plus its
+    // control noise.
+    void operator()(PoseBatch& particles, int left, int right) {
+        const uint64_t step = step_++;
+        const double twopi = 2 * MotionModel<double>::pi;
+        size_t n = particles.size();
+        size_t blocks = (n + block_size - 1) / block_size;
+        pool_->parallel_for(blocks, [&](size_t block) {
+            size_t end = std::min(n, (block + 1) * block_size);
+            for (size_t i = block * block_size; i < end; ++i) {
+                MotionModel<double, ScannerOffset<double>> model(particles.ticks_to_mm[i], particles.robot_width[i],
+                                                                 ScannerOffset<double>(scanner_displacement_));
+                double l = left * model.ticks_to_mm();
+                double r = right * model.ticks_to_mm();
+                double turn = noise_.turn_factor * (l - r);
+                double sigma_l = std::sqrt(noise_.motion_factor * l * noise_.motion_factor * l + turn * turn);
+                double sigma_r = std::sqrt(noise_.motion_factor * r * noise_.motion_factor * r + turn * turn);
+                auto z = philox_normal_pair(seed_, i, step);
+
+                auto pose = compose_poses(particles.pose(i), model.motion(l + sigma_l * z.first, r + sigma_r * z.second));
+                particles.x[i] = std::get<0>(pose);
+                particles.y[i] = std::get<1>(pose);
+                particles.theta[i] = std::fmod(std::get<2>(pose), twopi);
+            }
+        });
+    }
+};
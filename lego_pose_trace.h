@@ -0,0 +1,191 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Trace of the poses a filter computes, one "x y theta" line per pose, with
+// the policy chosen at compile time:
+//
+//     PoseTrace trace(std::cout);
+//     for (...) { pose = model.step(pose, ticks); trace.pose(pose); }
+//     trace.close();
+//
+// NoPoseTrace     does nothing; its calls are empty inline functions and
+//                 compile to nothing.
+// RingPoseTrace   keeps the last N poses in memory and writes them on
+//                 close(), for looking at how a run ended.
+// StreamPoseTrace writes every pose. The loop only appends the pose to a
+//                 buffer; full buffers are formatted and written by a
+//                 thread of their own, so the loop does not wait for the
+//                 stream. Up to max_queued full buffers queue up if the
+//                 stream is slower; past that, the loop waits for the
+//                 writer, so memory stays bounded and no pose is lost.
+//
+// PoseTrace is the policy chosen with -DLEGO_POSE_TRACE=none, ring or
+// stream (the default, which prints what the tools always printed). The
+// stream belongs to the trace until close(), which writes what is left
+// and must be called before anything else writes to the stream. close()
+// is also called by the destructor.
+
+// Writes one pose line.
+inline void write_pose_line(std::ostream& out, double x, double y, double theta) {
+    out << x << " " << y << " " << theta << "\n";
+}
+
+class NoPoseTrace {
+public:
+    explicit NoPoseTrace(std::ostream&, int = 12) {}
+    void pose(double, double, double) {}
+    template <typename Pose>
+    void pose(const Pose&) {}
+    void flush() {}
+    void close() {}
+};
+
+template <size_t N = 1024>
+class RingPoseTrace {
+private:
+    std::ostream* out_;
+    int precision_;
+    std::array<std::tuple<double, double, double>, N> ring_;
+    size_t count_ = 0;
+
+public:
+    explicit RingPoseTrace(std::ostream& out, int precision = 12) : out_(&out), precision_(precision) {}
+    RingPoseTrace(const RingPoseTrace&) = delete;
+    RingPoseTrace& operator=(const RingPoseTrace&) = delete;
+    ~RingPoseTrace() { close(); }
+
+    void pose(double x, double y, double theta) { ring_[count_++ % N] = std::make_tuple(x, y, theta); }
+    template <typename Pose>
+    void pose(const Pose& p) { pose(std::get<0>(p), std::get<1>(p), std::get<2>(p)); }
+
+    // Poses traced so far, including those already overwritten.
+    size_t count() const { return count_; }
+
+    void flush() {}
+
+    // Writes the last N poses, oldest first.
+    void close() {
+        if (!out_) return;
+        *out_ << std::fixed << std::setprecision(precision_);
+        for (size_t i = count_ > N ? count_ - N : 0; i < count_; ++i) {
+            const auto& p = ring_[i % N];
+            write_pose_line(*out_, std::get<0>(p), std::get<1>(p), std::get<2>(p));
+        }
+        out_->flush();
+        out_ = nullptr;
+    }
+};
+
+class StreamPoseTrace {
+private:
+    static constexpr size_t buffer_poses = 4096;
+    static constexpr size_t max_queued = 4; // Buffers waiting for the writer
+    using Buffer = std::vector<std::tuple<double, double, double>>;
+
+    std::ostream* out_;
+    int precision_;
+    Buffer buffer_;
+    std::mutex mutex_;
+    std::condition_variable ready_;   // A buffer was queued, or closing_ set
+    std::condition_variable written_; // A buffer was taken off the queue
+    std::deque<Buffer> queue_;
+    std::vector<Buffer> spare_; // Written buffers, for reuse
+    bool closing_ = false;
+    std::thread writer_;
+
+    void write_loop() {
+        *out_ << std::fixed << std::setprecision(precision_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            ready_.wait(lock, [this] { return closing_ || !queue_.empty(); });
+            if (queue_.empty()) break;
+            Buffer buffer = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            written_.notify_one();
+            for (const auto& p : buffer) write_pose_line(*out_, std::get<0>(p), std::get<1>(p), std::get<2>(p));
+            out_->flush();
+            buffer.clear();
+            lock.lock();
+            spare_.push_back(std::move(buffer));
+        }
+    }
+
+public:
+    explicit StreamPoseTrace(std::ostream& out, int precision = 12)
+        : out_(&out), precision_(precision), writer_(&StreamPoseTrace::write_loop, this) {
+        buffer_.reserve(buffer_poses);
+    }
+    StreamPoseTrace(const StreamPoseTrace&) = delete;
+    StreamPoseTrace& operator=(const StreamPoseTrace&) = delete;
+    ~StreamPoseTrace() { close(); }
+
+    void pose(double x, double y, double theta) {
+        buffer_.emplace_back(x, y, theta);
+        if (buffer_.size() == buffer_poses) flush();
+    }
+    template <typename Pose>
+    void pose(const Pose& p) { pose(std::get<0>(p), std::get<1>(p), std::get<2>(p)); }
+
+    // Hands the buffered poses to the writer without waiting for them to
+    // be written. Waits only while max_queued buffers are still queued.
+    void flush() {
+        if (buffer_.empty()) return;
+        Buffer next;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            written_.wait(lock, [this] { return queue_.size() < max_queued; });
+            queue_.push_back(std::move(buffer_));
+            if (!spare_.empty()) {
+                next = std::move(spare_.back());
+                spare_.pop_back();
+            }
+        }
+        ready_.notify_one();
+        if (next.capacity() == 0) next.reserve(buffer_poses);
+        buffer_ = std::move(next);
+    }
+
+    // Writes all traced poses and stops the writer.
+    void close() {
+        if (!writer_.joinable()) return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        ready_.notify_one();
+        writer_.join();
+    }
+};
+
+#define LEGO_POSE_TRACE_none 1
+#define LEGO_POSE_TRACE_ring 2
+#define LEGO_POSE_TRACE_stream 3
+#define LEGO_POSE_TRACE_POLICY(policy) LEGO_POSE_TRACE_POLICY_(policy)
+#define LEGO_POSE_TRACE_POLICY_(policy) LEGO_POSE_TRACE_##policy
+
+#ifndef LEGO_POSE_TRACE
+#define LEGO_POSE_TRACE stream
+#endif
+
+#if LEGO_POSE_TRACE_POLICY(LEGO_POSE_TRACE) == LEGO_POSE_TRACE_none
+using PoseTrace = NoPoseTrace;
+#elif LEGO_POSE_TRACE_POLICY(LEGO_POSE_TRACE) == LEGO_POSE_TRACE_ring
+using PoseTrace = RingPoseTrace<>;
+#elif LEGO_POSE_TRACE_POLICY(LEGO_POSE_TRACE) == LEGO_POSE_TRACE_stream
+using PoseTrace = StreamPoseTrace;
+#else
+#error "LEGO_POSE_TRACE must be none, ring or stream"
+#endif
@@ -2,13 +2,26 @@
 #pragma once
 
 #include <algorithm> // For std::max
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <cstring>
 #include <iterator> 
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <tuple>
 #include <map>
+#include <memory_resource>
+#include <mutex>
+
+#include "mapped_file.h"
+#include "parallel_for.h"
+#include "scan_store.h"
 
 // Python routines useful for handling ikg's LEGO robot data.
 // Author: Claus Brenner, 28.10.2012
@@ -17,6 +30,387 @@
 // If so, set this to true.
 bool s_record_has_count = true;
 
+// Why a log line could not be parsed.
+enum class LogLineError { None, TooFewFields, BadInteger, IntegerOutOfRange, BadFloat, FloatOutOfRange };
+
+inline const char* log_line_error_text(LogLineError error) {
+    switch (error) {
+        case LogLineError::None: return "no error";
+        case LogLineError::TooFewFields: return "record has too few fields";
+        case LogLineError::BadInteger: return "bad integer field";
+        case LogLineError::IntegerOutOfRange: return "integer field out of range";
+        case LogLineError::BadFloat: return "bad float field";
+        case LogLineError::FloatOutOfRange: return "float field out of range";
+    }
+    return "unknown error";
+}
+
+// Throws the exception std::stoi / std::stof would have thrown.
+[[noreturn]] inline void throw_log_line_error(LogLineError error) {
+    std::string message = std::string("LegoLogfile: ") + log_line_error_text(error);
+    if (error == LogLineError::BadInteger || error == LogLineError::BadFloat) throw std::invalid_argument(message);
+    throw std::out_of_range(message);
+}
+
+// Walks the whitespace separated tokens of one log line in place.
+// Numbers are converted with std::from_chars, so nothing is allocated.
+// The *_field() functions never throw: a missing or malformed token makes
+// them return 0 and remember the error, so a line is checked once, at its
+// end. next_int(), next_float() and skip() throw instead, like std::stoi /
+// std::stof would.
+class LogLineCursor {
+private:
+    const char* p_;
+    const char* end_;
+    LogLineError error_ = LogLineError::None;
+
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\n';
+    }
+
+    void skip_spaces() {
+        while (p_ != end_ && is_space(*p_)) ++p_;
+    }
+
+    void fail(LogLineError error) {
+        if (error_ == LogLineError::None) error_ = error;
+    }
+
+    void check() const {
+        if (error_ != LogLineError::None) throw_log_line_error(error_);
+    }
+
+public:
+    LogLineCursor(const char* first, const char* last) : p_(first), end_(last) {}
+
+    // The first error of the line so far.
+    LogLineError error() const { return error_; }
+    bool ok() const { return error_ == LogLineError::None; }
+
+    // True if there are no more tokens on the line.
+    bool at_end() {
+        skip_spaces();
+        return p_ == end_;
+    }
+
+    // True if at least n more tokens follow. Does not move the cursor.
+    bool has_fields(int n) const {
+        LogLineCursor probe = *this;
+        for (int i = 0; i < n; ++i) {
+            if (probe.next().empty()) return false;
+        }
+        return true;
+    }
+
+    // Returns the next token, or an empty view at the end of the line.
+    std::string_view next() {
+        skip_spaces();
+        const char* start = p_;
+        while (p_ != end_ && !is_space(*p_)) ++p_;
+        return std::string_view(start, static_cast<size_t>(p_ - start));
+    }
+
+    void skip_fields(int n) {
+        for (int i = 0; i < n; ++i) {
+            if (next().empty()) fail(LogLineError::TooFewFields);
+        }
+    }
+
+    int int_field() {
+        std::string_view tok = next();
+        const char* first = tok.data();
+        const char* last = first + tok.size();
+        if (first != last && *first == '+') ++first; // std::stoi accepts a leading '+'
+        int value = 0;
+        auto result = std::from_chars(first, last, value);
+        if (tok.empty()) fail(LogLineError::TooFewFields);
+        else if (result.ec == std::errc::invalid_argument) fail(LogLineError::BadInteger);
+        else if (result.ec == std::errc::result_out_of_range) fail(LogLineError::IntegerOutOfRange);
+        return value;
+    }
+
+    float float_field() {
+        std::string_view tok = next();
+        const char* first = tok.data();
+        const char* last = first + tok.size();
+        if (first != last && *first == '+') ++first;
+        float value = 0.0f;
+        auto result = std::from_chars(first, last, value);
+        if (tok.empty()) fail(LogLineError::TooFewFields);
+        else if (result.ec == std::errc::invalid_argument) fail(LogLineError::BadFloat);
+        else if (result.ec == std::errc::result_out_of_range) fail(LogLineError::FloatOutOfRange);
+        return value;
+    }
+
+    void skip(int n) {
+        skip_fields(n);
+        check();
+    }
+
+    int next_int() {
+        int value = int_field();
+        check();
+        return value;
+    }
+
+    float next_float() {
+        float value = float_field();
+        check();
+        return value;
+    }
+};
+
+// Returns the record type of a line, i.e. the first character of its first
+// token, or 0 for a blank line. Only looks at the leading bytes.
+inline char log_record_type(const char* first, const char* last) {
+    while (first != last && (*first == ' ' || *first == '\t' || *first == '\r' || *first == '\v' || *first == '\f')) ++first;
+    return first != last ? *first : 0;
+}
+
+// A set of record types, used to read only the records a tool needs, e.g.
+// logfile.read_mapped("robot4_motors.txt", RecordSet("M")). Lines of other
+// types are skipped after looking at their first byte, without parsing.
+class RecordSet {
+private:
+    uint32_t bits_; // Bit i stands for the letter 'A' + i
+
+    static uint32_t bit(char type) {
+        return type >= 'A' && type <= 'Z' ? uint32_t(1) << (type - 'A') : 0;
+    }
+
+public:
+    // All record types.
+    RecordSet() : bits_(~uint32_t(0)) {}
+
+    // The record types listed in types, e.g. "MS".
+    explicit RecordSet(const char* types) : bits_(0) {
+        for (; *types != '\0'; ++types) bits_ |= bit(*types);
+    }
+
+    static RecordSet all() { return RecordSet(); }
+    static RecordSet none() { return RecordSet(""); }
+
+    bool contains(char type) const { return (bits_ & bit(type)) != 0; }
+    void insert(char type) { bits_ |= bit(type); }
+
+    // Bit i stands for the letter 'A' + i.
+    uint32_t bits() const { return bits_; }
+};
+
+// One record of a log, as delivered by LegoLogReader.
+// Only the field belonging to the record type is set. The fields have the
+// same types as the lists of LegoLogfile. The views point into the reader
+// and stay valid until the next record is read.
+struct LogRecord {
+    char type = 0; // 'P', 'S', 'I', 'M', 'F', 'L' or 'D', or an extra type
+    int timestamp = 0;                                       // P, S, I, M
+    std::tuple<int, int> reference_position;                 // P
+    ScanView<int> scan;                                      // S
+    ScanView<std::uint16_t> compact_scan;                    // S, instead of scan when reading compact scans
+    ScanView<int> pole_indices;                              // I
+    std::tuple<int, int> motor_ticks;                        // M, difference to the previous M record
+    std::tuple<float, float, float> filtered_position;       // F
+    std::tuple<char, float, float, float> landmark;          // L
+    ScanView<std::tuple<float, float>> detected_cylinders;   // D
+};
+
+// The record types a parser knows, as a list of handlers; the dispatch on
+// the tag is unrolled at compile time. A handler is a type with
+//   static constexpr char tag;      the first character of its lines
+//   static int min_fields();        fields a line needs after the tag
+//   static void clear(Log& log);    empties its lists in log
+//   static LogLineError parse(Log& log, LogLineCursor& cursor, State& state);
+//   static bool view(const Log& log, LogLineCursor cursor, LogRecord& record);
+// where the cursor stands after the tag. A line with fewer fields than
+// min_fields() is rejected with LogLineError::TooFewFields before the
+// handler sees it, and every reader skips it; parse() must not report
+// TooFewFields itself, so that short_line() can tell without parsing.
+// parse() reads the rest of the line and appends it to the lists, or
+// returns an error and leaves them as they were. The first record of a
+// type in a read call replaces what its lists held before; state.seen (a
+// RecordSet) records which types that were.
+// view() fills record from the only record of log, for the streaming
+// readers, and returns false if the line gave none.
+template <typename... Handlers>
+struct RecordRegistry {
+    // The same handlers followed by More.
+    template <typename... More>
+    using with = RecordRegistry<Handlers..., More...>;
+
+    static constexpr bool tags_are_distinct() {
+        const char tags[] = {Handlers::tag..., 0};
+        for (size_t i = 0; i < sizeof...(Handlers); ++i) {
+            if (tags[i] < 'A' || tags[i] > 'Z') return false;
+            for (size_t j = 0; j < i; ++j) if (tags[i] == tags[j]) return false;
+        }
+        return true;
+    }
+    static_assert(tags_are_distinct(), "record tags must be distinct letters A .. Z");
+
+    // Parses the rest of a line of type `type` and sets error. Returns false
+    // if no handler has that tag.
+    template <typename Log, typename State>
+    static bool parse([[maybe_unused]] char type, [[maybe_unused]] Log& log, [[maybe_unused]] LogLineCursor& cursor,
+                      [[maybe_unused]] State& state, [[maybe_unused]] LogLineError& error) {
+        return ((type == Handlers::tag && (error = parse_as<Handlers>(log, cursor, state), true)) || ...);
+    }
+
+    // True if the rest of a line of type `type` has too few fields for its
+    // handler. Lines of unknown types are never short.
+    static bool short_line([[maybe_unused]] char type, [[maybe_unused]] const LogLineCursor& cursor) {
+        bool is_short = false;
+        ((type == Handlers::tag && (is_short = !cursor.has_fields(Handlers::min_fields()), true)) || ...);
+        return is_short;
+    }
+
+    // Fills record from log, which holds only the record of one line of
+    // type `type`. Returns false if there is none.
+    template <typename Log>
+    static bool view([[maybe_unused]] char type, [[maybe_unused]] const Log& log, [[maybe_unused]] const LogLineCursor& cursor,
+                     [[maybe_unused]] LogRecord& record) {
+        bool has_record = false;
+        ((type == Handlers::tag && (has_record = Handlers::view(log, cursor, record), true)) || ...);
+        return has_record;
+    }
+
+private:
+    template <typename Handler, typename Log, typename State>
+    static LogLineError parse_as(Log& log, LogLineCursor& cursor, State& state) {
+        if (!cursor.has_fields(Handler::min_fields())) return LogLineError::TooFewFields;
+        if (!state.seen.contains(Handler::tag)) {
+            Handler::clear(log);
+            state.seen.insert(Handler::tag);
+        }
+        return Handler::parse(log, cursor, state);
+    }
+};
+
+// What LegoLogfile::read_robust() found in a log.
+struct ParseStats {
+    struct RejectedLine {
+        uint64_t offset; // Byte offset of the line in the file
+        char type;
+        LogLineError error;
+    };
+
+    static const size_t max_rejected = 1000; // Rejected lines kept with their offsets
+
+    size_t lines_by_type[26] = {}; // Parsed lines of types 'A' .. 'Z'
+    size_t other_lines = 0;        // Parsed lines not starting with a letter
+    size_t skipped_lines = 0;      // Lines of types not wanted
+    size_t blank_lines = 0;
+    size_t rejected_lines = 0;
+    std::vector<RejectedLine> rejected; // The first max_rejected of them
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+
+    size_t lines(char type) const {
+        return type >= 'A' && type <= 'Z' ? lines_by_type[type - 'A'] : 0;
+    }
+
+    void count(char type) {
+        if (type >= 'A' && type <= 'Z') ++lines_by_type[type - 'A'];
+        else ++other_lines;
+    }
+
+    void reject(uint64_t offset, char type, LogLineError error) {
+        ++rejected_lines;
+        if (rejected.size() < max_rejected) rejected.push_back(RejectedLine{offset, type, error});
+    }
+
+    std::string report() const {
+        std::ostringstream out;
+        out << bytes << " bytes in " << seconds << " s";
+        if (seconds > 0.0) out << " (" << bytes / seconds / (1024.0 * 1024.0) << " MB/s)";
+        out << "\n";
+        for (int t = 0; t < 26; ++t) {
+            if (lines_by_type[t] > 0) out << char('A' + t) << " records: " << lines_by_type[t] << "\n";
+        }
+        out << "other: " << other_lines << ", skipped: " << skipped_lines << ", blank: " << blank_lines
+            << ", rejected: " << rejected_lines << "\n";
+        for (const RejectedLine& line : rejected) {
+            out << "  rejected " << line.type << " record at byte " << line.offset << ": "
+                << log_line_error_text(line.error) << "\n";
+        }
+        if (rejected.size() < rejected_lines) out << "  ... " << rejected_lines - rejected.size() << " more\n";
+        return out.str();
+    }
+};
+
+// Memory held by the list (or lists) of one record type of a LegoLogfile.
+// payload_bytes are the values themselves, overhead_bytes the containers
+// around them (vector objects, one per record for I and D, and scan
+// offsets), slack_bytes capacity that is allocated but unused. The
+// allocator's own bookkeeping is not counted.
+struct RecordFootprint {
+    char type;
+    size_t records = 0;
+    size_t payload_bytes = 0;
+    size_t overhead_bytes = 0;
+    size_t slack_bytes = 0;
+
+    size_t total_bytes() const { return payload_bytes + overhead_bytes + slack_bytes; }
+
+    template <typename T>
+    void add(const std::pmr::vector<T>& list) {
+        payload_bytes += list.size() * sizeof(T);
+        overhead_bytes += sizeof(list);
+        slack_bytes += (list.capacity() - list.size()) * sizeof(T);
+    }
+
+    // A list of lists: every inner vector is overhead, as is its slack
+    // in the outer list.
+    template <typename T>
+    void add(const std::pmr::vector<std::pmr::vector<T>>& lists) {
+        overhead_bytes += sizeof(lists) + lists.size() * sizeof(lists[0]);
+        slack_bytes += (lists.capacity() - lists.size()) * sizeof(std::pmr::vector<T>);
+        for (const auto& list : lists) {
+            payload_bytes += list.size() * sizeof(T);
+            slack_bytes += (list.capacity() - list.size()) * sizeof(T);
+        }
+    }
+
+    // Ranges past the last ended scan are slack as well.
+    template <typename T>
+    void add(const BasicScanStore<T>& scans) {
+        size_t count = scans.offsets().back();
+        payload_bytes += count * sizeof(T);
+        overhead_bytes += sizeof(scans) + scans.offsets().size() * sizeof(size_t);
+        slack_bytes += (scans.ranges().capacity() - count) * sizeof(T) +
+                       (scans.offsets().capacity() - scans.offsets().size()) * sizeof(size_t);
+    }
+};
+
+// Lets several threads allocate from one memory resource, e.g. an arena,
+// which is not thread-safe itself: every call goes to upstream under a
+// mutex. shared() is what to hand to the threads.
+class LockedResource : public std::pmr::memory_resource {
+private:
+    std::pmr::memory_resource* upstream_;
+    std::mutex mutex_;
+
+public:
+    explicit LockedResource(std::pmr::memory_resource* upstream) : upstream_(upstream) {}
+
+    // upstream itself if it is the (thread-safe) global heap, else this.
+    std::pmr::memory_resource* shared() {
+        return upstream_ == std::pmr::new_delete_resource() ? upstream_ : this;
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        upstream_->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
 // Class holding log data of our Lego robot.
 // The logfile understands the following records:
 // P reference position (of the robot)
@@ -28,19 +422,337 @@ bool s_record_has_count = true;
 // D detected landmark, in the scanner's coordinate system
 //
 class LegoLogfile {
+    friend class LegoLogBinary;
+    friend class IndexedLogfile;
+    friend class LegoLogWriter;
+    friend class LegoLogNpy;
+    friend class LegoDataset;
+    friend class LogCache;
+    template <typename>
+    friend class BasicLogRecordParser;
+
 private:
-    std::vector<std::tuple<int, int>> reference_positions;
-    std::vector<std::vector<int>> pole_indices;
-    std::vector<std::tuple<float, float, float>> filtered_positions; // May contain heading
-    std::vector<std::tuple<char, float, float, float>> landmarks; // Type, x, y, diameter
-    std::vector<std::vector<std::tuple<float, float>>> detected_cylinders;
-    std::tuple<int, int> last_ticks;
+    std::pmr::vector<std::tuple<int, int>> reference_positions;
+    std::pmr::vector<std::pmr::vector<int>> pole_indices;
+    std::pmr::vector<std::tuple<float, float, float>> filtered_positions; // May contain heading
+    std::pmr::vector<std::tuple<char, float, float, float>> landmarks; // Type, x, y, diameter
+    std::pmr::vector<std::pmr::vector<std::tuple<float, float>>> detected_cylinders;
+    std::tuple<int, int> last_ticks; // Of the last M record read
+    std::vector<int> scratch_ints; // Reused by read_mapped() for I records.
+    std::vector<std::tuple<float, float>> scratch_cylinders; // And for D records.
+
+protected:
+    struct ReadState {
+        RecordSet seen = RecordSet::none();       // Types read so far; their first record replaced the list
+        bool have_last_ticks = false;             // An M record has been parsed, so last_ticks is set
+        std::tuple<int, int> first_ticks{0, 0};   // Of the first M record
+        int first_ticks_timestamp = 0;
+        RecordSet wanted;                         // Other record types are skipped
+        ParseStats* stats = nullptr;              // If set, bad lines are counted instead of thrown
+    };
+
+    // Handlers of the built-in record types, see RecordRegistry.
+    struct ReferencePositionRecord {
+        static constexpr char tag = 'P';
+        static int min_fields() { return 3; } // Timestamp, x, y
+        static void clear(LegoLogfile& log) { log.reference_positions.clear(); }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState&) {
+            cursor.skip_fields(1);
+            int x = cursor.int_field();
+            int y = cursor.int_field();
+            if (!cursor.ok()) return cursor.error();
+            log.reference_positions.emplace_back(x, y);
+            return LogLineError::None;
+        }
+        static bool view(const LegoLogfile& log, LogLineCursor cursor, LogRecord& record) {
+            record.timestamp = cursor.int_field();
+            record.reference_position = log.reference_positions.front();
+            return true;
+        }
+    };
+
+    struct ScanRecord {
+        static constexpr char tag = 'S';
+        static int min_fields() { return s_record_has_count ? 2 : 1; } // Timestamp and count, may have no ranges
+        static void clear(LegoLogfile& log) {
+            log.scan_data.clear();
+            log.compact_scan_data.clear();
+            log.scan_timestamps.clear();
+        }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState&) {
+            int timestamp = cursor.int_field();
+            if (s_record_has_count) cursor.skip_fields(1);
+            // begin_scan() drops the ranges of a scan which was not ended.
+            if (log.compact_scans) {
+                log.compact_scan_data.begin_scan();
+                while (!cursor.at_end()) log.compact_scan_data.push_range(compact_range(cursor.int_field()));
+                if (!cursor.ok()) {
+                    log.compact_scan_data.begin_scan();
+                    return cursor.error();
+                }
+                log.compact_scan_data.end_scan();
+            } else {
+                log.scan_data.begin_scan();
+                while (!cursor.at_end()) log.scan_data.push_range(cursor.int_field());
+                if (!cursor.ok()) {
+                    log.scan_data.begin_scan();
+                    return cursor.error();
+                }
+                log.scan_data.end_scan();
+            }
+            log.scan_timestamps.push_back(timestamp);
+            return LogLineError::None;
+        }
+        static bool view(const LegoLogfile& log, LogLineCursor, LogRecord& record) {
+            record.timestamp = log.scan_timestamps.front();
+            if (log.compact_scans) record.compact_scan = log.compact_scan_data[0];
+            else record.scan = log.scan_data[0];
+            return true;
+        }
+    };
+
+    struct PoleIndexRecord {
+        static constexpr char tag = 'I';
+        static int min_fields() { return 1; } // Timestamp, may have no indices
+        static void clear(LegoLogfile& log) { log.pole_indices.clear(); }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState&) {
+            cursor.skip_fields(1);
+            log.scratch_ints.clear();
+            while (!cursor.at_end()) log.scratch_ints.push_back(cursor.int_field());
+            if (!cursor.ok()) return cursor.error();
+            log.pole_indices.emplace_back(log.scratch_ints.begin(), log.scratch_ints.end());
+            return LogLineError::None;
+        }
+        static bool view(const LegoLogfile& log, LogLineCursor cursor, LogRecord& record) {
+            record.timestamp = cursor.int_field();
+            record.pole_indices = ScanView<int>(log.pole_indices.front().data(), log.pole_indices.front().size());
+            return true;
+        }
+    };
+
+    struct MotorRecord {
+        static constexpr char tag = 'M';
+        static int min_fields() { return 6; } // Timestamp, left ticks, 3 others, right ticks
+        static void clear(LegoLogfile& log) {
+            log.motor_ticks.clear();
+            log.motor_timestamps.clear();
+        }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState& state) {
+            int timestamp = cursor.int_field();
+            int left_ticks = cursor.int_field();
+            cursor.skip_fields(3);
+            int right_ticks = cursor.int_field();
+            if (!cursor.ok()) return cursor.error();
+            if (state.have_last_ticks) {
+                log.motor_ticks.emplace_back(left_ticks - std::get<0>(log.last_ticks),
+                                             right_ticks - std::get<1>(log.last_ticks));
+                log.motor_timestamps.push_back(timestamp);
+            } else {
+                state.first_ticks = std::make_tuple(left_ticks, right_ticks);
+                state.first_ticks_timestamp = timestamp;
+                log.motor_start_timestamp = timestamp;
+            }
+            log.last_ticks = std::make_tuple(left_ticks, right_ticks);
+            state.have_last_ticks = true;
+            return LogLineError::None;
+        }
+        // The first M record only starts the differences.
+        static bool view(const LegoLogfile& log, LogLineCursor, LogRecord& record) {
+            if (log.motor_ticks.empty()) return false;
+            record.timestamp = log.motor_timestamps.front();
+            record.motor_ticks = log.motor_ticks.front();
+            return true;
+        }
+    };
+
+    struct FilteredPositionRecord {
+        static constexpr char tag = 'F';
+        static int min_fields() { return 2; } // x, y; the heading is optional
+        static void clear(LegoLogfile& log) { log.filtered_positions.clear(); }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState&) {
+            float x = cursor.float_field();
+            float y = cursor.float_field();
+            float heading = cursor.at_end() ? 0.0f : cursor.float_field();
+            if (!cursor.ok()) return cursor.error();
+            log.filtered_positions.emplace_back(x, y, heading);
+            return LogLineError::None;
+        }
+        static bool view(const LegoLogfile& log, LogLineCursor, LogRecord& record) {
+            record.filtered_position = log.filtered_positions.front();
+            return true;
+        }
+    };
+
+    struct LandmarkRecord {
+        static constexpr char tag = 'L';
+        static int min_fields() { return 4; } // Type, x, y, diameter
+        static void clear(LegoLogfile& log) { log.landmarks.clear(); }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState&) {
+            char type = cursor.next()[0];
+            float x = cursor.float_field();
+            float y = cursor.float_field();
+            float diameter = cursor.float_field();
+            if (!cursor.ok()) return cursor.error();
+            log.landmarks.emplace_back(type, x, y, diameter);
+            return LogLineError::None;
+        }
+        static bool view(const LegoLogfile& log, LogLineCursor, LogRecord& record) {
+            record.landmark = log.landmarks.front();
+            return true;
+        }
+    };
+
+    struct DetectedCylinderRecord {
+        static constexpr char tag = 'D';
+        static int min_fields() { return 1; } // Timestamp, may have no cylinders
+        static void clear(LegoLogfile& log) { log.detected_cylinders.clear(); }
+        static LogLineError parse(LegoLogfile& log, LogLineCursor& cursor, ReadState&) {
+            cursor.skip_fields(1);
+            log.scratch_cylinders.clear();
+            while (!cursor.at_end()) {
+                float x = cursor.float_field();
+                if (cursor.at_end()) break; // An x without y is dropped
+                float y = cursor.float_field();
+                log.scratch_cylinders.emplace_back(x, y);
+            }
+            if (!cursor.ok()) return cursor.error();
+            log.detected_cylinders.emplace_back(log.scratch_cylinders.begin(), log.scratch_cylinders.end());
+            return LogLineError::None;
+        }
+        static bool view(const LegoLogfile& log, LogLineCursor, LogRecord& record) {
+            const auto& cylinders = log.detected_cylinders.front();
+            record.detected_cylinders = ScanView<std::tuple<float, float>>(cylinders.data(), cylinders.size());
+            return true;
+        }
+    };
+
+    using BuiltinRecords = RecordRegistry<ReferencePositionRecord, ScanRecord, PoleIndexRecord, MotorRecord,
+                                          FilteredPositionRecord, LandmarkRecord, DetectedCylinderRecord>;
+    using Registry = BuiltinRecords; // What try_parse_line() parses; ExtendedLogfile has its own
+
+    // Parses one line (without the newline) into log with the handlers of
+    // Registry. Never throws: a malformed line leaves the lists as they
+    // were, and its error is returned. Unknown record types are skipped.
+    template <typename Registry, typename Log>
+    static LogLineError parse_record_line(Log& log, const char* first, const char* last, ReadState& state) {
+        LogLineCursor cursor(first, last);
+        std::string_view record_type = cursor.next();
+        if (record_type.empty()) return LogLineError::None;
+        LogLineError error = LogLineError::None;
+        Registry::parse(record_type[0], log, cursor, state, error);
+        return error;
+    }
+
+    // Same, for the built-in record types.
+    LogLineError try_parse_line(const char* first, const char* last, ReadState& state) {
+        return parse_record_line<BuiltinRecords>(*this, first, last, state);
+    }
+
+    // Same as try_parse_line(), but a malformed line throws.
+    // Lines with too few fields throw as well.
+    void parse_line(const char* first, const char* last, ReadState& state) {
+        LogLineError error = try_parse_line(first, last, state);
+        if (error != LogLineError::None) throw_log_line_error(error);
+    }
+
+    // Parses all lines in [first, last). Returns false if a blank line
+    // ended the log. Lines with too few fields are skipped, as in read().
+    // With state.stats set, nothing ends the log: blank lines are skipped,
+    // malformed and short lines are dropped, and all are counted, with
+    // offsets relative to first.
+    bool parse_range(const char* first, const char* last, ReadState& state) {
+        return parse_range(first, last, state, [this](const char* line, const char* eol, char, ReadState& s) {
+            return try_parse_line(line, eol, s);
+        });
+    }
+
+    // Same, with each wanted line going to parse_line(first, last, type,
+    // state), which returns a LogLineError like try_parse_line().
+    template <typename ParseLine>
+    bool parse_range(const char* first, const char* last, ReadState& state, ParseLine parse_line) {
+        ParseStats* stats = state.stats;
+        const char* p = first;
+        while (p < last) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(last - p)));
+            if (eol == nullptr) eol = last;
+            char type = log_record_type(p, eol);
+            if (type == 0) {
+                if (stats == nullptr) return false;
+                ++stats->blank_lines;
+            } else if (!state.wanted.contains(type)) {
+                if (stats != nullptr) ++stats->skipped_lines;
+            } else {
+                LogLineError error = parse_line(p, eol, type, state);
+                if (stats == nullptr) {
+                    if (error != LogLineError::None && error != LogLineError::TooFewFields) throw_log_line_error(error);
+                } else if (error != LogLineError::None) {
+                    stats->reject(static_cast<uint64_t>(p - first), type, error);
+                } else {
+                    stats->count(type);
+                }
+            }
+            p = eol + 1;
+        }
+        return true;
+    }
+
+    // Parses the lines of in with parse_line(first, last, state) up to the
+    // first blank line, as read() does: lines with too few fields are
+    // skipped, other malformed lines throw.
+    template <typename ParseLine>
+    static void read_lines(std::istream& in, ParseLine parse_line) {
+        ReadState state;
+        std::string line;
+        while (std::getline(in, line)) {
+            const char* first = line.data();
+            const char* last = first + line.size();
+            if (log_record_type(first, last) == 0) break;
+            LogLineError error = parse_line(first, last, state);
+            if (error == LogLineError::TooFewFields) continue;
+            if (error != LogLineError::None) throw_log_line_error(error);
+        }
+    }
+
+private:
+    template <typename T>
+    static void append_list(std::pmr::vector<T>& list, std::pmr::vector<T>& other) {
+        list.insert(list.end(), std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+    }
+
+    template <typename T>
+    static void append_list(BasicScanStore<T>& list, const BasicScanStore<T>& other) {
+        list.append(other);
+    }
 
 public:
-    LegoLogfile() : last_ticks(-1, -1) {}
+    // All lists allocate from resource. Passing an arena, e.g. a
+    // std::pmr::monotonic_buffer_resource, turns the allocations of every
+    // I and D record into a few large blocks, and makes destroying the
+    // logfile nearly free. The resource must outlive the logfile; copies of
+    // the logfile use the global heap.
+    // An arena keeps the old buffers of a growing list, so for large scan
+    // logs call scan_data.reserve() first if the sizes are known.
+    explicit LegoLogfile(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : reference_positions(resource), pole_indices(resource), filtered_positions(resource),
+          landmarks(resource), detected_cylinders(resource), last_ticks(0, 0), motor_ticks(resource),
+          scan_data(resource), motor_timestamps(resource), scan_timestamps(resource),
+          compact_scan_data(resource) {}
+
+    std::pmr::vector<std::tuple<int, int>> motor_ticks;
+    ScanStore scan_data; // All scans in one buffer, scan_data[i] is a view of scan i.
+
+    // Timestamps (field 1 of the record) of motor_ticks and scans, with the
+    // same indices. The timestamp of a tick difference is that of the M
+    // record which ends it; motor_start_timestamp is that of the first M
+    // record, i.e. the time of the pose before motor_ticks[0].
+    std::pmr::vector<int> motor_timestamps;
+    std::pmr::vector<int> scan_timestamps;
+    int motor_start_timestamp = 0;
 
-    std::vector<std::tuple<int, int>> motor_ticks;
-    std::vector<std::vector<int>> scan_data;
+    // If set before read(), S records go to compact_scan_data (16 bit ranges)
+    // instead of scan_data, which then stays empty.
+    bool compact_scans = false;
+    CompactScanStore compact_scan_data;
     
     void read(const std::string& filename) {
         // Reads log data from file. Calling this multiple times with different
@@ -48,130 +760,229 @@ public:
         // M and S data, and the other contains M and P data, then LegoLogfile
         // will contain S from the first file and M and P from the second file.
         std::ifstream file(filename);
-        std::string line;
-        bool first_reference_positions = true;
-        bool first_scan_data = true;
-        bool first_pole_indices = true;
-        bool first_motor_ticks = true;
-        bool first_filtered_positions = true;
-        bool first_landmarks = true;
-        bool first_detected_cylinders = true;
-
-        while (std::getline(file, line)) {
-            std::istringstream iss(line);
-            std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
-                                            std::istream_iterator<std::string>{}};
-            if (tokens.empty()) break;
-
-            char record_type = tokens[0][0];
-            switch (record_type) {
-                case 'P': {
-                    // P is the reference position.
-                    if (first_reference_positions) {
-                        reference_positions.clear();
-                        first_reference_positions = false;
-                    }
-                    int x = std::stoi(tokens[2]);
-                    int y = std::stoi(tokens[3]);
-                    reference_positions.emplace_back(x, y);
-                    break;
-                }
-                case 'S': {
-                    // S is the scan data.
-                    if (first_scan_data) {
-                        scan_data.clear();
-                        first_scan_data = false;
-                    }
-                    std::vector<int> scan;
-                    for (size_t i = s_record_has_count ? 3 : 2; i < tokens.size(); ++i) {
-                        scan.push_back(std::stoi(tokens[i]));
-                    }
-                    scan_data.push_back(scan);
-                    break;
-                }
-                case 'I': {
-                    // I is indices of poles in the scan.
-                    if (first_pole_indices) {
-                        pole_indices.clear();
-                        first_pole_indices = false;
-                    }
-                    std::vector<int> indices;
-                    for (size_t i = 2; i < tokens.size(); ++i) {
-                        indices.push_back(std::stoi(tokens[i]));
-                    }
-                    pole_indices.push_back(indices);
-                    break;
-                }
-                case 'M': {
-                    // M is the motor data.
-                    if (first_motor_ticks) {
-                        motor_ticks.clear();
-                        first_motor_ticks = false;
-                        last_ticks = std::make_tuple(-1, -1);
-                    }
-                    int left_ticks = std::stoi(tokens[2]);
-                    int right_ticks = std::stoi(tokens[6]);
-                    if (std::get<0>(last_ticks) != -1) {
-                        motor_ticks.emplace_back(left_ticks - std::get<0>(last_ticks),
-                                                 right_ticks - std::get<1>(last_ticks));
-                    }
-                    last_ticks = std::make_tuple(left_ticks, right_ticks);
-                    break;
-                }
-                case 'F': {
-                    // F is filtered trajectory.
-                    if (first_filtered_positions) {
-                        filtered_positions.clear();
-                        first_filtered_positions = false;
-                    }
-                    float x = std::stof(tokens[1]);
-                    float y = std::stof(tokens[2]);
-                    float heading = tokens.size() > 3 ? std::stof(tokens[3]) : 0.0f;
-                    filtered_positions.emplace_back(x, y, heading);
-                    break;
-                }
-                case 'L': {
-                    // L is landmark.
-                    if (first_landmarks) {
-                        landmarks.clear();
-                        first_landmarks = false;
-                    }
-                    char type = tokens[1][0];
-                    float x = std::stof(tokens[2]);
-                    float y = std::stof(tokens[3]);
-                    float diameter = std::stof(tokens[4]);
-                    landmarks.emplace_back(type, x, y, diameter);
-                    break;
-                }
-                case 'D': {
-                    // D is detected landmarks.
-                    if (first_detected_cylinders) {
-                        detected_cylinders.clear();
-                        first_detected_cylinders = false;
-                    }
-                    std::vector<std::tuple<float, float>> cylinders;
-                    for (size_t i = 2; i < tokens.size(); i += 2) {
-                        float x = std::stof(tokens[i]);
-                        float y = std::stof(tokens[i + 1]);
-                        cylinders.emplace_back(x, y);
-                    }
-                    detected_cylinders.push_back(cylinders);
-                    break;
-                }
-                default:
-                    break; // Unknown record type
+        read_lines(file, [this](const char* first, const char* last, ReadState& state) {
+            return try_parse_line(first, last, state);
+        });
+    }
+
+    void read_mapped(const std::string& filename, RecordSet wanted = RecordSet::all()) {
+        // Same as read(), with the same merge behaviour, but the file is
+        // memory-mapped and each line is tokenized in place. On large scan
+        // logs this is several times faster than read().
+        // Only records of the wanted types are parsed; the other lists are
+        // left as they are.
+        MappedFile file(filename);
+        ReadState state;
+        state.wanted = wanted;
+        parse_range(file.begin(), file.end(), state);
+    }
+
+    ParseStats read_robust(const std::string& filename, RecordSet wanted = RecordSet::all()) {
+        // Same as read_mapped(), for logs which may be damaged, e.g. cut off
+        // by a power loss. Never throws on a bad line: malformed lines are
+        // dropped, blank lines (also the zero bytes a power loss can leave)
+        // are skipped instead of ending the log, and the returned stats say
+        // what was found where.
+        auto start = std::chrono::steady_clock::now();
+        ParseStats stats;
+        MappedFile file(filename);
+        ReadState state;
+        state.wanted = wanted;
+        state.stats = &stats;
+        parse_range(file.begin(), file.end(), state);
+        stats.bytes = file.size();
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    void read_parallel(const std::string& filename, unsigned threads = 0, RecordSet wanted = RecordSet::all()) {
+        // Same as read_mapped(), but the file is cut at line boundaries into
+        // one chunk per thread (0 means one per core), the chunks are parsed
+        // concurrently, and the results are joined in file order. The chunks
+        // allocate from this logfile's memory resource. On an error, the
+        // records before it are joined, as read_mapped() leaves them, and
+        // the error is rethrown.
+        MappedFile file(filename);
+        if (file.empty()) return;
+        if (threads == 0) threads = default_thread_count();
+
+        std::vector<const char*> bounds(1, file.begin());
+        for (unsigned i = 1; i < threads; ++i) {
+            const char* p = std::max(file.begin() + file.size() / threads * i, bounds.back());
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(file.end() - p)));
+            bounds.push_back(eol != nullptr ? eol + 1 : file.end());
+        }
+        bounds.push_back(file.end());
+
+        struct Chunk {
+            LegoLogfile log;
+            ReadState state;
+            bool complete = true;
+            std::exception_ptr error;
+            explicit Chunk(std::pmr::memory_resource* resource) : log(resource) {}
+        };
+        LockedResource resource(motor_ticks.get_allocator().resource());
+        std::vector<Chunk> chunks;
+        chunks.reserve(threads);
+        for (unsigned k = 0; k < threads; ++k) chunks.emplace_back(resource.shared());
+        parallel_for(chunks.size(), threads, [&](size_t k) {
+            Chunk& chunk = chunks[k];
+            chunk.log.compact_scans = compact_scans;
+            chunk.state.wanted = wanted;
+            try {
+                chunk.complete = chunk.log.parse_range(bounds[k], bounds[k + 1], chunk.state);
+            } catch (...) {
+                chunk.error = std::current_exception();
+            }
+        });
+
+        // A sequential read would have thrown at the first error, or stopped
+        // at the first blank line, whichever comes first. The chunk with the
+        // error holds the records before it.
+        size_t used = chunks.size();
+        std::exception_ptr error;
+        for (size_t k = 0; k < chunks.size(); ++k) {
+            if (chunks[k].error || !chunks[k].complete) {
+                error = chunks[k].error;
+                used = k + 1;
+                break;
+            }
+        }
+
+        // Lists seen in any chunk replace ours, as in read().
+        auto join = [&](auto list, char type) {
+            bool seen = false;
+            for (size_t k = 0; k < used; ++k) seen = seen || chunks[k].state.seen.contains(type);
+            if (!seen) return;
+            (this->*list).clear();
+            for (size_t k = 0; k < used; ++k) append_list(this->*list, chunks[k].log.*list);
+        };
+        join(&LegoLogfile::reference_positions, 'P');
+        join(&LegoLogfile::scan_data, 'S');
+        join(&LegoLogfile::compact_scan_data, 'S');
+        join(&LegoLogfile::scan_timestamps, 'S');
+        join(&LegoLogfile::pole_indices, 'I');
+        join(&LegoLogfile::filtered_positions, 'F');
+        join(&LegoLogfile::landmarks, 'L');
+        join(&LegoLogfile::detected_cylinders, 'D');
+
+        // Each chunk starts without a previous M record, so the difference
+        // across every seam is missing. Put it back while joining.
+        bool seen_motor_ticks = false;
+        bool have_last_ticks = false;
+        for (size_t k = 0; k < used; ++k) {
+            Chunk& chunk = chunks[k];
+            if (!chunk.state.seen.contains('M')) continue;
+            if (!seen_motor_ticks) {
+                motor_ticks.clear();
+                motor_timestamps.clear();
+                seen_motor_ticks = true;
+            }
+            if (!chunk.state.have_last_ticks) continue; // Only malformed M records
+            if (have_last_ticks) {
+                motor_ticks.emplace_back(std::get<0>(chunk.state.first_ticks) - std::get<0>(last_ticks),
+                                         std::get<1>(chunk.state.first_ticks) - std::get<1>(last_ticks));
+                motor_timestamps.push_back(chunk.state.first_ticks_timestamp);
+            } else {
+                motor_start_timestamp = chunk.state.first_ticks_timestamp;
+            }
+            append_list(motor_ticks, chunk.log.motor_ticks);
+            append_list(motor_timestamps, chunk.log.motor_timestamps);
+            last_ticks = chunk.log.last_ticks;
+            have_last_ticks = true;
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    void read_files(const std::vector<std::string>& filenames, unsigned threads = 0, RecordSet wanted = RecordSet::all()) {
+        // Same as calling read_mapped() for each file in turn, but the files
+        // are parsed concurrently, one per task on up to `threads` threads
+        // of the shared_thread_pool() (0 means all of them), largest first,
+        // so the load takes about as long as the largest file. The parts
+        // allocate from this logfile's memory resource. The results are merged in file order: a
+        // list is taken from the last file that has records of its type. If
+        // a file fails, the files before it (and the part of it read up to
+        // the error) are merged, as a sequential read would leave them, and
+        // the error is rethrown.
+        struct Part {
+            LegoLogfile log;
+            ReadState state;
+            std::exception_ptr error;
+            explicit Part(std::pmr::memory_resource* resource) : log(resource) {}
+        };
+        LockedResource resource(motor_ticks.get_allocator().resource());
+        std::vector<Part> parts;
+        parts.reserve(filenames.size());
+        std::vector<std::pair<uint64_t, size_t>> order; // Size and index, largest first
+        for (size_t k = 0; k < filenames.size(); ++k) {
+            parts.emplace_back(resource.shared());
+            struct stat st;
+            order.emplace_back(::stat(filenames[k].c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0, k);
+        }
+        std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        shared_thread_pool().parallel_for(order.size(), [&](size_t i) {
+            Part& part = parts[order[i].second];
+            part.log.compact_scans = compact_scans;
+            part.state.wanted = wanted;
+            try {
+                MappedFile file(filenames[order[i].second]);
+                part.log.parse_range(file.begin(), file.end(), part.state);
+            } catch (...) {
+                part.error = std::current_exception();
+            }
+        }, threads);
+
+        for (Part& part : parts) {
+            LegoLogfile& log = part.log;
+            const ReadState& s = part.state;
+            if (s.seen.contains('P')) reference_positions = std::move(log.reference_positions);
+            if (s.seen.contains('S')) {
+                scan_data = std::move(log.scan_data);
+                compact_scan_data = std::move(log.compact_scan_data);
+                scan_timestamps = std::move(log.scan_timestamps);
             }
+            if (s.seen.contains('I')) pole_indices = std::move(log.pole_indices);
+            if (s.seen.contains('M')) {
+                motor_ticks = std::move(log.motor_ticks);
+                motor_timestamps = std::move(log.motor_timestamps);
+                motor_start_timestamp = log.motor_start_timestamp;
+                last_ticks = log.last_ticks;
+            }
+            if (s.seen.contains('F')) filtered_positions = std::move(log.filtered_positions);
+            if (s.seen.contains('L')) landmarks = std::move(log.landmarks);
+            if (s.seen.contains('D')) detected_cylinders = std::move(log.detected_cylinders);
+            if (part.error) std::rethrow_exception(part.error);
         }
-        file.close();
     }
 
+    bool operator==(const LegoLogfile& other) const {
+        return reference_positions == other.reference_positions && scan_data == other.scan_data &&
+               compact_scan_data == other.compact_scan_data &&
+               pole_indices == other.pole_indices && motor_ticks == other.motor_ticks &&
+               motor_timestamps == other.motor_timestamps && scan_timestamps == other.scan_timestamps &&
+               motor_start_timestamp == other.motor_start_timestamp &&
+               filtered_positions == other.filtered_positions && landmarks == other.landmarks &&
+               detected_cylinders == other.detected_cylinders;
+    }
+
+    bool operator!=(const LegoLogfile& other) const { return !(*this == other); }
+
     size_t size() const {
         // Return the number of entries. Take the max, since some lists may be empty.
-        return std::max({reference_positions.size(), scan_data.size(),
+        return std::max({reference_positions.size(), scan_data.size(), compact_scan_data.size(),
                          pole_indices.size(), motor_ticks.size(),
                          filtered_positions.size(), detected_cylinders.size()});
     }
 
+    // True if a line has too few fields for its record type. Every read
+    // function skips such lines, so a LogIndex does not count them either.
+    static bool is_short_line(const char* first, const char* last) {
+        LogLineCursor cursor(first, last);
+        std::string_view record_type = cursor.next();
+        return !record_type.empty() && BuiltinRecords::short_line(record_type[0], cursor);
+    }
+
     static double beam_index_to_angle(int i, double mounting_angle = -0.06981317007977318) {
         // Convert a beam index to an angle, in radians.
         return (i - 330.0) * 0.006135923151543 + mounting_angle;
@@ -186,6 +997,8 @@ public:
 
         if (i < scan_data.size()) {
             s += " | scan-points: " + std::to_string(scan_data[i].size());
+        } else if (i < compact_scan_data.size()) {
+            s += " | scan-points: " + std::to_string(compact_scan_data[i].size());
         }
 
         if (i < pole_indices.size()) {
@@ -210,4 +1023,69 @@ public:
 
         return s;
     }
+
+    // Memory held by each record type, in the order P S I M F L D. Motor
+    // and scan timestamps count for M and S.
+    std::vector<RecordFootprint> footprint() const {
+        std::vector<RecordFootprint> result;
+        RecordFootprint p{'P'};
+        p.records = reference_positions.size();
+        p.add(reference_positions);
+        result.push_back(p);
+
+        RecordFootprint s{'S'};
+        s.records = scan_data.size() + compact_scan_data.size();
+        s.add(scan_data);
+        s.add(compact_scan_data);
+        s.add(scan_timestamps);
+        result.push_back(s);
+
+        RecordFootprint i{'I'};
+        i.records = pole_indices.size();
+        i.add(pole_indices);
+        result.push_back(i);
+
+        RecordFootprint m{'M'};
+        m.records = motor_ticks.size();
+        m.add(motor_ticks);
+        m.add(motor_timestamps);
+        result.push_back(m);
+
+        RecordFootprint f{'F'};
+        f.records = filtered_positions.size();
+        f.add(filtered_positions);
+        result.push_back(f);
+
+        RecordFootprint l{'L'};
+        l.records = landmarks.size();
+        l.add(landmarks);
+        result.push_back(l);
+
+        RecordFootprint d{'D'};
+        d.records = detected_cylinders.size();
+        d.add(detected_cylinders);
+        result.push_back(d);
+        return result;
+    }
+
+    // Summary of the footprint, one line per record type that holds
+    // memory, and the total.
+    static std::string info(const std::vector<RecordFootprint>& footprint) {
+        std::ostringstream out;
+        RecordFootprint total{' '};
+        for (const RecordFootprint& f : footprint) {
+            total.records += f.records;
+            total.payload_bytes += f.payload_bytes;
+            total.overhead_bytes += f.overhead_bytes;
+            total.slack_bytes += f.slack_bytes;
+            if (f.records == 0 && f.payload_bytes + f.slack_bytes == 0) continue;
+            out << f.type << " " << f.records << " records, " << f.payload_bytes << " payload, "
+                << f.overhead_bytes << " overhead, " << f.slack_bytes << " slack bytes\n";
+        }
+        out << "total " << total.records << " records, " << total.total_bytes() << " bytes (" << total.payload_bytes
+            << " payload, " << total.overhead_bytes << " overhead, " << total.slack_bytes << " slack)\n";
+        return out.str();
+    }
+
+    std::string info() const { return info(footprint()); }
 };
\ No newline at end of file
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "lego_robot.h"
+#include "mapped_file.h"
+#include "scan_store.h"
+
+// Lossless compressed form of the scans (S records) of a log.
+// Neighbouring beams differ by a few millimetres, and consecutive scans
+// are nearly the same, so each range is stored as its difference to a
+// prediction from the neighbouring beam, the same beam of the previous
+// scan, or both. The differences are zigzag coded (small negative numbers
+// become small positive ones) and written as varints of 7 bits per byte,
+// which takes one or two bytes for almost every beam.
+//
+// Scans are grouped into blocks. The first scan of a block does not refer
+// to the previous scan, so a block decodes on its own, and a block index
+// leads to any scan without decoding the ones before its block.
+//
+// Layout (native byte order, i.e. little endian on our machines):
+//   ScanCodecHeader
+//   ScanCodecBlock[block_count]   the block index
+//   block data
+// Each scan in a block is
+//   varint   zigzag(timestamp - timestamp of the previous scan, 0 for the first)
+//   varint   beam count
+//   byte     predictor (ScanPredictor)
+//   varint   zigzag(range - prediction), for every beam
+
+struct ScanCodecHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_scans; // Scans per block, except for the last block
+    uint64_t scan_count;
+    uint64_t range_count; // Of all scans
+    uint64_t block_count;
+    uint64_t file_size;
+};
+
+struct ScanCodecBlock {
+    uint64_t offset;      // Of the block data, from the start of the file
+    uint64_t first_range; // Number of ranges in all blocks before this one
+};
+
+static const char scan_codec_magic[8] = {'L', 'E', 'G', 'O', 'S', 'C', 'N', '1'};
+static const uint32_t scan_codec_version = 1;
+
+// How the ranges of a scan are predicted; p is the previous scan.
+enum class ScanPredictor : uint8_t {
+    Beam = 0,  // r[i - 1]
+    Scan = 1,  // p[i]
+    Both = 2   // r[i - 1] + p[i] - p[i - 1]
+};
+
+// Differences are taken in unsigned 32 bit arithmetic, which wraps instead
+// of overflowing, so any int range round-trips.
+inline uint32_t zigzag_encode(uint32_t delta) {
+    return (delta << 1) ^ static_cast<uint32_t>(-static_cast<int32_t>(delta >> 31));
+}
+
+inline uint32_t zigzag_decode(uint32_t value) {
+    return (value >> 1) ^ static_cast<uint32_t>(-static_cast<int32_t>(value & 1));
+}
+
+inline size_t varint_size(uint32_t value) {
+    size_t n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+inline void put_varint(std::vector<char>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Reads a varint at p. Returns false if it runs past end or is too long.
+inline bool get_varint(const char*& p, const char* end, uint32_t& value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) return false;
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The prediction of beam i of scan r, given the previous scan p (which has
+// the same number of beams unless the predictor is Beam).
+template <ScanPredictor Predictor>
+inline uint32_t predict_range(const uint32_t* r, const uint32_t* p, size_t i) {
+    if constexpr (Predictor == ScanPredictor::Beam) return i > 0 ? r[i - 1] : 0;
+    if constexpr (Predictor == ScanPredictor::Scan) return p[i];
+    if constexpr (Predictor == ScanPredictor::Both) return i > 0 ? r[i - 1] + p[i] - p[i - 1] : p[i];
+}
+
+// Reads a varint which is known to end before the end of the data.
+inline uint32_t get_varint_unchecked(const char*& p) {
+    uint32_t byte = static_cast<uint8_t>(*p++);
+    if (byte < 0x80) return byte;
+    uint32_t result = byte & 0x7f;
+    for (int shift = 7; shift < 35; shift += 7) {
+        byte = static_cast<uint8_t>(*p++);
+        result |= (byte & 0x7f) << shift;
+        if (byte < 0x80) break;
+    }
+    return result;
+}
+
+// Decodes count ranges into r. Returns false if the data runs out.
+template <ScanPredictor Predictor>
+inline bool decode_ranges(const char*& p, const char* end, uint32_t* r, const uint32_t* previous, size_t count) {
+    if (static_cast<size_t>(end - p) / 5 >= count) {
+        // Room for count varints of the longest kind, no need to check each byte.
+        for (size_t i = 0; i < count; ++i) {
+            r[i] = predict_range<Predictor>(r, previous, i) + zigzag_decode(get_varint_unchecked(p));
+        }
+        return true;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t residual;
+        if (!get_varint(p, end, residual)) return false;
+        r[i] = predict_range<Predictor>(r, previous, i) + zigzag_decode(residual);
+    }
+    return true;
+}
+
+// Bytes the residuals of scan r take with a predictor.
+template <ScanPredictor Predictor>
+inline size_t encoded_size(const std::vector<uint32_t>& r, const std::vector<uint32_t>& previous) {
+    size_t size = 0;
+    for (size_t i = 0; i < r.size(); ++i) {
+        size += varint_size(zigzag_encode(r[i] - predict_range<Predictor>(r.data(), previous.data(), i)));
+    }
+    return size;
+}
+
+template <ScanPredictor Predictor>
+inline void encode_ranges(std::vector<char>& out, const std::vector<uint32_t>& r, const std::vector<uint32_t>& previous) {
+    for (size_t i = 0; i < r.size(); ++i) {
+        put_varint(out, zigzag_encode(r[i] - predict_range<Predictor>(r.data(), previous.data(), i)));
+    }
+}
+
+// A memory-mapped compressed scan file, for decoding all scans or seeking
+// to single ones.
+class ScanCodecFile {
+private:
+    MappedFile file_;
+    ScanCodecHeader header_;
+    const ScanCodecBlock* blocks_ = nullptr;
+
+public:
+    ScanCodecFile() { std::memset(&header_, 0, sizeof(header_)); }
+
+    explicit ScanCodecFile(const std::string& filename) : ScanCodecFile() { open(filename); }
+
+    // Maps the file and checks header and block index. Returns false if
+    // the file is missing, not a scan codec file, or truncated.
+    bool open(const std::string& filename) {
+        file_ = MappedFile(filename);
+        blocks_ = nullptr;
+        std::memset(&header_, 0, sizeof(header_));
+        if (file_.size() < sizeof(ScanCodecHeader)) return false;
+
+        ScanCodecHeader header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (std::memcmp(header.magic, scan_codec_magic, sizeof(header.magic)) != 0 ||
+            header.version != scan_codec_version || header.file_size != file_.size() || header.block_scans == 0 ||
+            header.range_count > file_.size() || // Every range takes at least one byte
+            header.block_count != (header.scan_count + header.block_scans - 1) / header.block_scans ||
+            header.block_count > (file_.size() - sizeof(ScanCodecHeader)) / sizeof(ScanCodecBlock)) {
+            return false;
+        }
+        const ScanCodecBlock* blocks = reinterpret_cast<const ScanCodecBlock*>(file_.data() + sizeof(ScanCodecHeader));
+        for (uint64_t b = 0; b < header.block_count; ++b) {
+            if (blocks[b].offset > file_.size()) return false;
+        }
+        header_ = header;
+        blocks_ = blocks;
+        return true;
+    }
+
+    bool valid() const { return blocks_ != nullptr; }
+    size_t scan_count() const { return static_cast<size_t>(header_.scan_count); }
+    size_t block_count() const { return static_cast<size_t>(header_.block_count); }
+    size_t block_scans() const { return header_.block_scans; }
+    uint64_t range_count() const { return header_.range_count; }
+
+    // Decodes block b, calling f(scan index, timestamp, ranges, beam count)
+    // for each of its scans. Returns false if the block is corrupt.
+    template <typename Function>
+    bool decode_block(size_t b, Function f) const {
+        if (b >= header_.block_count) return false;
+        const char* p = file_.data() + blocks_[b].offset;
+        const char* end = b + 1 < header_.block_count ? file_.data() + blocks_[b + 1].offset : file_.end();
+        if (end < p) return false;
+        size_t first = b * header_.block_scans;
+        size_t last = std::min<size_t>(first + header_.block_scans, scan_count());
+
+        std::vector<uint32_t> current, previous;
+        uint32_t timestamp = 0;
+        for (size_t s = first; s < last; ++s) {
+            uint32_t time_delta, count;
+            if (!get_varint(p, end, time_delta) || !get_varint(p, end, count) || p == end) return false;
+            ScanPredictor predictor = static_cast<ScanPredictor>(*p++);
+            if (predictor != ScanPredictor::Beam && (predictor > ScanPredictor::Both || count != previous.size())) return false;
+            if (count > static_cast<size_t>(end - p)) return false; // At least one byte per beam
+            timestamp += zigzag_decode(time_delta);
+
+            current.resize(count);
+            uint32_t* r = current.data();
+            bool ok = predictor == ScanPredictor::Beam ? decode_ranges<ScanPredictor::Beam>(p, end, r, previous.data(), count)
+                    : predictor == ScanPredictor::Scan ? decode_ranges<ScanPredictor::Scan>(p, end, r, previous.data(), count)
+                    : decode_ranges<ScanPredictor::Both>(p, end, r, previous.data(), count);
+            if (!ok) return false;
+            f(s, static_cast<int>(timestamp), reinterpret_cast<const int*>(r), static_cast<size_t>(count));
+            current.swap(previous);
+        }
+        return true;
+    }
+
+    // Decodes scan i alone (and the scans before it in its block).
+    bool scan(size_t i, std::vector<int>& ranges, int* timestamp = nullptr) const {
+        if (i >= scan_count()) return false;
+        return decode_block(i / header_.block_scans, [&](size_t s, int t, const int* r, size_t n) {
+            if (s != i) return;
+            ranges.assign(r, r + n);
+            if (timestamp != nullptr) *timestamp = t;
+        });
+    }
+
+    // Decodes all scans, appending them to scans and timestamps.
+    template <typename T, typename Timestamps>
+    bool decode_all(BasicScanStore<T>& scans, Timestamps& timestamps) const {
+        scans.reserve(scans.size() + scan_count(), scans.offsets().back() + static_cast<size_t>(range_count()));
+        timestamps.reserve(timestamps.size() + scan_count());
+        for (size_t b = 0; b < block_count(); ++b) {
+            bool ok = decode_block(b, [&](size_t, int t, const int* r, size_t n) {
+                if constexpr (std::is_same_v<T, std::uint16_t>) {
+                    scans.begin_scan();
+                    for (size_t i = 0; i < n; ++i) scans.push_range(compact_range(r[i]));
+                    scans.end_scan();
+                } else {
+                    scans.emplace_back(r, r + n);
+                }
+                timestamps.push_back(t);
+            });
+            if (!ok) return false;
+        }
+        return true;
+    }
+};
+
+// Conversion between the scans of a LegoLogfile and the compressed form.
+class LegoScanCodec {
+private:
+    // Encodes one scan after choosing the predictor that gives the fewest bytes.
+    static void encode_scan(std::vector<char>& out, uint32_t time_delta, const std::vector<uint32_t>& r,
+                            const std::vector<uint32_t>& previous, bool has_previous) {
+        ScanPredictor best = ScanPredictor::Beam;
+        if (has_previous && previous.size() == r.size()) {
+            size_t beam = encoded_size<ScanPredictor::Beam>(r, previous);
+            size_t scan = encoded_size<ScanPredictor::Scan>(r, previous);
+            size_t both = encoded_size<ScanPredictor::Both>(r, previous);
+            if (scan < beam && scan <= both) best = ScanPredictor::Scan;
+            else if (both < beam) best = ScanPredictor::Both;
+        }
+        put_varint(out, zigzag_encode(time_delta));
+        put_varint(out, static_cast<uint32_t>(r.size()));
+        out.push_back(static_cast<char>(best));
+        if (best == ScanPredictor::Beam) encode_ranges<ScanPredictor::Beam>(out, r, previous);
+        else if (best == ScanPredictor::Scan) encode_ranges<ScanPredictor::Scan>(out, r, previous);
+        else encode_ranges<ScanPredictor::Both>(out, r, previous);
+    }
+
+    template <typename T, typename Timestamps>
+    static bool write_scans(const BasicScanStore<T>& scans, const Timestamps& timestamps,
+                            const std::string& filename, uint32_t block_scans) {
+        if (block_scans == 0) block_scans = 1;
+        size_t scan_count = scans.size();
+        size_t block_count = (scan_count + block_scans - 1) / block_scans;
+        std::vector<ScanCodecBlock> blocks(block_count);
+        std::vector<char> data;
+        std::vector<uint32_t> current, previous;
+        uint64_t ranges = 0;
+        uint32_t timestamp = 0;
+        uint64_t data_start = sizeof(ScanCodecHeader) + block_count * sizeof(ScanCodecBlock);
+
+        for (size_t s = 0; s < scan_count; ++s) {
+            bool block_start = s % block_scans == 0;
+            if (block_start) {
+                blocks[s / block_scans] = ScanCodecBlock{data_start + data.size(), ranges};
+                timestamp = 0;
+            }
+            ScanView<T> scan = scans[s];
+            current.assign(scan.begin(), scan.end());
+            uint32_t t = static_cast<uint32_t>(s < timestamps.size() ? timestamps[s] : 0);
+            encode_scan(data, t - timestamp, current, previous, !block_start);
+            timestamp = t;
+            ranges += current.size();
+            current.swap(previous);
+        }
+
+        ScanCodecHeader header;
+        std::memcpy(header.magic, scan_codec_magic, sizeof(header.magic));
+        header.version = scan_codec_version;
+        header.block_scans = block_scans;
+        header.scan_count = scan_count;
+        header.range_count = ranges;
+        header.block_count = block_count;
+        header.file_size = data_start + data.size();
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(blocks.data()), static_cast<std::streamsize>(blocks.size() * sizeof(ScanCodecBlock)));
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return static_cast<bool>(file);
+    }
+
+public:
+    static const uint32_t default_block_scans = 64;
+
+    static bool is_scan_codec(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        char magic[8] = {};
+        file.read(magic, sizeof(magic));
+        return file && std::memcmp(magic, scan_codec_magic, sizeof(magic)) == 0;
+    }
+
+    // Writes the scans of the logfile (scan_data, or compact_scan_data if
+    // that is the one in use) with their timestamps. Returns false on I/O
+    // errors.
+    static bool write(const LegoLogfile& log, const std::string& filename, uint32_t block_scans = default_block_scans) {
+        if (log.scan_data.empty() && !log.compact_scan_data.empty()) {
+            return write_scans(log.compact_scan_data, log.scan_timestamps, filename, block_scans);
+        }
+        return write_scans(log.scan_data, log.scan_timestamps, filename, block_scans);
+    }
+
+    // Loads the scans into the logfile, replacing its scans and scan
+    // timestamps like a read() of an S-only log; the other lists are kept.
+    // Returns false if the file is not a valid scan codec file.
+    static bool read(LegoLogfile& log, const std::string& filename) {
+        ScanCodecFile codec(filename);
+        if (!codec.valid()) return false;
+        log.scan_data.clear();
+        log.compact_scan_data.clear();
+        log.scan_timestamps.clear();
+        bool ok = log.compact_scans ? codec.decode_all(log.compact_scan_data, log.scan_timestamps)
+                                    : codec.decode_all(log.scan_data, log.scan_timestamps);
+        if (!ok) {
+            log.scan_data.clear();
+            log.compact_scan_data.clear();
+            log.scan_timestamps.clear();
+        }
+        return ok;
+    }
+};
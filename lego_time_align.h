@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <vector>
+
+#include "lego_robot.h"
+
+// Joins records of different sensors by time instead of by index.
+// Index pairing (scan i with motor record i) breaks as soon as the logger
+// drops a record; pairing by timestamp does not.
+
+// Interpolates a trajectory at the given times. poses[i] is the (x, y,
+// heading) pose at pose_times[i]. Both time lists must be sorted, so this
+// is one linear merge over the two columns. Positions are interpolated
+// linearly, the heading along the shorter way round. Times before the
+// first or after the last pose get that pose, nothing is extrapolated.
+// The time lists are vectors of int, std or pmr.
+template <typename PoseTimes, typename Times>
+std::vector<std::tuple<double, double, double>> interpolate_poses(
+        const PoseTimes& pose_times, const std::vector<std::tuple<double, double, double>>& poses,
+        const Times& times) {
+    const double pi = 3.14159265358979323846;
+    std::vector<std::tuple<double, double, double>> result;
+    size_t n = std::min(pose_times.size(), poses.size());
+    if (n == 0) return result;
+    result.reserve(times.size());
+
+    size_t j = 0; // pose_times[j] is the first pose time >= t, or n
+    for (size_t k = 0; k < times.size(); ++k) {
+        int t = times[k];
+        if (k > 0 && t < times[k - 1]) j = 0; // Out of order, start the merge over
+        while (j < n && pose_times[j] < t) ++j;
+
+        if (j == 0) {
+            result.push_back(poses[0]);
+        } else if (j == n) {
+            result.push_back(poses[n - 1]);
+        } else {
+            const auto& a = poses[j - 1];
+            const auto& b = poses[j];
+            double f = double(t - pose_times[j - 1]) / double(pose_times[j] - pose_times[j - 1]);
+            double turn = std::remainder(std::get<2>(b) - std::get<2>(a), 2 * pi);
+            result.emplace_back(std::get<0>(a) + f * (std::get<0>(b) - std::get<0>(a)),
+                                std::get<1>(a) + f * (std::get<1>(b) - std::get<1>(a)),
+                                std::get<2>(a) + f * turn);
+        }
+    }
+    return result;
+}
+
+// Pairs each scan of the logfile with the odometry at the scan's time.
+// start is the pose at log.motor_start_timestamp (the first M record), and
+// poses[i] the pose after applying log.motor_ticks[i], as the filter loops
+// in our tools produce them; it is taken to be at log.motor_timestamps[i].
+// Returns one pose per scan, in scan order.
+inline std::vector<std::tuple<double, double, double>> align_scans_to_odometry(
+        const LegoLogfile& log, const std::tuple<double, double, double>& start,
+        const std::vector<std::tuple<double, double, double>>& poses) {
+    size_t n = std::min(log.motor_timestamps.size(), poses.size());
+    std::vector<int> pose_times;
+    std::vector<std::tuple<double, double, double>> all_poses;
+    pose_times.reserve(n + 1);
+    all_poses.reserve(n + 1);
+    pose_times.push_back(log.motor_start_timestamp);
+    all_poses.push_back(start);
+    pose_times.insert(pose_times.end(), log.motor_timestamps.begin(), log.motor_timestamps.begin() + n);
+    all_poses.insert(all_poses.end(), poses.begin(), poses.begin() + n);
+    return interpolate_poses(pose_times, all_poses, log.scan_timestamps);
+}
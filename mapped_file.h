@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file.
+// The mapping is released when the object goes out of scope. A file that
+// cannot be opened, or is empty, gives an empty mapping (data() == nullptr).
+class MappedFile {
+private:
+    const char* data_;
+    size_t size_;
+
+public:
+    MappedFile() : data_(nullptr), size_(0) {}
+
+    explicit MappedFile(const std::string& filename) : data_(nullptr), size_(0) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                // We scan the file front to back, so let the kernel read ahead.
+                ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(p);
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = other.data_;
+            size_ = other.size_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    ~MappedFile() { unmap(); }
+
+    const char* data() const { return data_; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    void unmap() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+    }
+};
+
+// Writes filename by way of a uniquely named temporary file next to it:
+// write(temporary) fills the temporary file and returns false on failure,
+// and only a complete file is renamed over filename. So readers see the
+// old file or the whole new one, and concurrent writers, in this process
+// or others, never write into each other's files. Returns false if
+// filename was not replaced.
+template <typename Write>
+bool replace_file(const std::string& filename, Write write) {
+    std::string temporary = filename + ".XXXXXX";
+    int fd = ::mkstemp(&temporary[0]);
+    if (fd < 0) return false;
+    ::fchmod(fd, 0644); // mkstemp() creates the file readable by its owner only
+    ::close(fd);
+    if (!write(temporary) || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// 64 bit hash of a byte range, eight bytes at a time. Files derived from
+// a log (cache, index) store it to tell whether the log changed.
+inline uint64_t content_hash(const char* data, size_t size) {
+    const uint64_t k = 0x9e3779b97f4a7c15ull;
+    uint64_t h = size * k;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, data + i, 8);
+        w *= k;
+        h = (h ^ (w ^ (w >> 29))) * 0xbf58476d1ce4e5b9ull;
+    }
+    uint64_t tail = 0;
+    if (size > i) std::memcpy(&tail, data + i, size - i);
+    h = (h ^ (tail * k)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+// Modification times closer than this may be the same tick of the file
+// system clock (FAT keeps 2 s, others coarse kernel ticks). A file
+// modified that close before a file derived from it was written may have
+// changed again without a new time, so only its contents tell.
+const int64_t mtime_granularity_ns = 2000000000;
+
+// The wall clock, on the scale of st_mtim.
+inline int64_t realtime_ns() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
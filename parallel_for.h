@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads to use when the caller passes 0.
+inline unsigned default_thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls f(i) for every i in [0, count), spread over up to `threads` threads
+// (0 means one per core). The calling thread takes part, and indices are
+// handed out one by one, so uneven work balances out. f must not throw.
+template <typename Function>
+void parallel_for(size_t count, unsigned threads, Function f) {
+    if (threads == 0) threads = default_thread_count();
+    if (threads > count) threads = static_cast<unsigned>(count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) f(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i = next++; i < count; i = next++) f(i);
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+}
+
+// Threads which are started once and then run one parallel_for() after
+// the other, for loops that run too often to start threads every time:
+//
+//     ThreadPool pool(4);
+//     for (...) pool.parallel_for(count, [&](size_t i) { ... });
+//
+// A pool of n threads has n - 1 workers; the calling thread takes part as
+// in parallel_for(). One loop runs at a time, calls from several threads
+// take turns, so f must not start a loop on the same pool. f must not
+// throw.
+class ThreadPool {
+private:
+    std::mutex run_mutex_; // Held while a loop runs
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    uint64_t generation_ = 0; // Number of loops started
+    unsigned busy_ = 0;       // Workers still in the current loop
+    bool stopping_ = false;
+    void (*job_)(void*, unsigned) = nullptr;
+    void* context_ = nullptr;
+    std::vector<std::thread> workers_;
+
+    void work_loop(unsigned worker) {
+        uint64_t generation = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [&] { return stopping_ || generation_ != generation; });
+            if (stopping_) return;
+            generation = generation_;
+            lock.unlock();
+            job_(context_, worker);
+            lock.lock();
+            if (--busy_ == 0) idle_.notify_one();
+        }
+    }
+
+public:
+    // threads as for parallel_for (0 means one per core).
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) threads = default_thread_count();
+        workers_.reserve(threads - 1);
+        for (unsigned t = 1; t < threads; ++t) workers_.emplace_back(&ThreadPool::work_loop, this, t);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) worker.join();
+    }
+
+    // Number of threads a loop runs on, the calling one included.
+    unsigned size() const { return static_cast<unsigned>(workers_.size()) + 1; }
+
+    // Same as ::parallel_for(count, threads, f) on the threads of the pool,
+    // using at most `threads` of them (0 means all).
+    template <typename Function>
+    void parallel_for(size_t count, Function f, unsigned threads = 0) {
+        if (threads == 0 || threads > size()) threads = size();
+        if (threads > count) threads = static_cast<unsigned>(count);
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; ++i) f(i);
+            return;
+        }
+
+        struct Loop {
+            std::atomic<size_t> next{0};
+            size_t count;
+            unsigned threads;
+            Function* f;
+
+            static void run(void* context, unsigned worker) {
+                Loop& loop = *static_cast<Loop*>(context);
+                if (worker >= loop.threads) return;
+                for (size_t i = loop.next++; i < loop.count; i = loop.next++) (*loop.f)(i);
+            }
+        };
+        Loop loop;
+        loop.count = count;
+        loop.threads = threads;
+        loop.f = &f;
+
+        std::lock_guard<std::mutex> run_lock(run_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &Loop::run;
+            context_ = &loop;
+            busy_ = static_cast<unsigned>(workers_.size());
+            ++generation_;
+        }
+        wake_.notify_all();
+        Loop::run(&loop, 0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return busy_ == 0; });
+    }
+};
+
+// A pool with one thread per core, started on first use, for library code
+// that runs many loops, e.g. LegoLogfile::read_files().
+inline ThreadPool& shared_thread_pool() {
+    static ThreadPool pool;
+    return pool;
+}
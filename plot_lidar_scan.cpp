@@ -2,19 +2,18 @@
 #include <string>
 #include <vector>
 #include "lego_robot.h" 
+#include "lego_log_index.h"
 #include "matplotlibcpp.h"
 
 int main() {
-	// Create an instance of LegoLogfile.
-	LegoLogfile logfile;
-
-	// Read the log file.
-	logfile.read("robot4_scan.txt");
+	// Open the log file for random access. Only the scan we plot is parsed,
+	// using the byte offsets in robot4_scan.txt.idx (built on first use).
+	IndexedLogfile logfile("robot4_scan.txt");
 
 	// Check if there is at least one scan data available.
-	if (logfile.scan_data.size() > 8) {
+	if (logfile.count('S') > 8) {
 		// Retrieve the 9th scan data (index 8).
-		std::vector<int> scan = logfile.scan_data[8];
+		std::vector<int> scan = logfile.scan(8);
 
 		// Convert scan data to a format acceptable by matplotlibcpp.
 		std::vector<double> x(scan.size()), y(scan.size());
@@ -1,13 +1,14 @@
 #include <iostream>
 #include <vector>
 #include "lego_robot.h" // Your custom class to handle LegoLogfile operations
+#include "lego_log_cache.h"
 #include "matplotlibcpp.h" // Include the matplotlibcpp header
 
 namespace plt = matplotlibcpp; // Shorten namespace for convenience
 
 int main() {
 	LegoLogfile logfile;
-	logfile.read("robot4_motors.txt");
+	LogCache::read(logfile, "robot4_motors.txt", RecordSet("M"));
 
 	auto motor_ticks = logfile.motor_ticks; // Assuming getMotorTicks() returns a vector of pairs
 
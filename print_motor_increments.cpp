@@ -1,11 +1,12 @@
 #include <iostream>
 #include "lego_robot.h" // Assuming this is the header file for the LegoLogfile class
+#include "lego_log_cache.h"
 
 // Rest of the code goes here
 
 int main() {
     LegoLogfile logfile;
-    logfile.read("robot4_motors.txt");
+    LogCache::read(logfile, "robot4_motors.txt", RecordSet("M"));
 
     for (int i = 0; i < 20; ++i) {
         auto tuple_ticks = logfile.motor_ticks[i]; // Assuming this is a std::tuple<int, int>
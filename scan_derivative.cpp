@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include "lego_robot.h"
+#include "lego_log_index.h"
 #include "matplotlibcpp.h"
 
 namespace plt = matplotlibcpp;
@@ -28,14 +29,14 @@ std::vector<double> compute_derivative(const std::vector<int>& scan, double min_
 int main() {
     double minimum_valid_distance = 20.0;
 
-    // Read the logfile which contains all scans.
-    LegoLogfile logfile;
-    logfile.read("robot4_scan.txt");
+    // Open the logfile which contains all scans. Only the scan we pick is
+    // parsed, using the byte offset index of the file.
+    IndexedLogfile logfile("robot4_scan.txt");
 
     // Pick one scan.
     int scan_no = 7;
-    if (scan_no < logfile.scan_data.size()) {
-        std::vector<int> scan = logfile.scan_data[scan_no];
+    if (scan_no < logfile.count('S')) {
+        std::vector<int> scan = logfile.scan(scan_no);
 
         // Compute derivative, (-1, 0, 1) mask.
         std::vector<double> der = compute_derivative(scan, minimum_valid_distance);
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Read-only view of one scan (the ranges of one S record).
+// It behaves like a small const container and converts to a std::vector,
+// so code written against std::vector<int> scans keeps working.
+template <typename T>
+class ScanView {
+private:
+    const T* data_;
+    size_t size_;
+
+public:
+    using value_type = T;
+    using const_iterator = const T*;
+
+    ScanView() : data_(nullptr), size_(0) {}
+    ScanView(const T* data, size_t size) : data_(data), size_(size) {}
+
+    const T* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    const T& front() const { return data_[0]; }
+    const T& back() const { return data_[size_ - 1]; }
+
+    // Copies the scan, e.g. std::vector<int> scan = logfile.scan_data[8];
+    template <typename U>
+    operator std::vector<U>() const { return std::vector<U>(begin(), end()); }
+};
+
+// All scans of a log in compressed sparse row form: the ranges of every
+// scan back to back in one buffer, and offsets[i] .. offsets[i + 1] giving
+// the part belonging to scan i. Adding a scan does not allocate per scan,
+// and consecutive scans are adjacent in memory.
+// Both buffers allocate from a std::pmr::memory_resource, by default the
+// global heap.
+template <typename T>
+class BasicScanStore {
+private:
+    std::pmr::vector<T> ranges_;
+    std::pmr::vector<size_t> offsets_;
+
+public:
+    using value_type = ScanView<T>;
+
+    class const_iterator {
+    private:
+        const BasicScanStore* store_;
+        size_t i_;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = ScanView<T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = ScanView<T>;
+
+        const_iterator(const BasicScanStore* store, size_t i) : store_(store), i_(i) {}
+        ScanView<T> operator*() const { return (*store_)[i_]; }
+        ScanView<T> operator[](difference_type n) const { return (*store_)[i_ + n]; }
+        const_iterator& operator++() { ++i_; return *this; }
+        const_iterator operator++(int) { const_iterator old = *this; ++i_; return old; }
+        const_iterator& operator--() { --i_; return *this; }
+        const_iterator operator--(int) { const_iterator old = *this; --i_; return old; }
+        const_iterator& operator+=(difference_type n) { i_ += n; return *this; }
+        const_iterator& operator-=(difference_type n) { i_ -= n; return *this; }
+        const_iterator operator+(difference_type n) const { return const_iterator(store_, i_ + n); }
+        const_iterator operator-(difference_type n) const { return const_iterator(store_, i_ - n); }
+        difference_type operator-(const const_iterator& other) const {
+            return static_cast<difference_type>(i_) - static_cast<difference_type>(other.i_);
+        }
+        bool operator==(const const_iterator& other) const { return i_ == other.i_; }
+        bool operator!=(const const_iterator& other) const { return i_ != other.i_; }
+        bool operator<(const const_iterator& other) const { return i_ < other.i_; }
+    };
+
+    BasicScanStore() : offsets_(1, 0) {}
+
+    explicit BasicScanStore(std::pmr::memory_resource* resource) : ranges_(resource), offsets_(1, 0, resource) {}
+
+    // Number of scans.
+    size_t size() const { return offsets_.size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    ScanView<T> operator[](size_t i) const {
+        return ScanView<T>(ranges_.data() + offsets_[i], offsets_[i + 1] - offsets_[i]);
+    }
+    ScanView<T> at(size_t i) const {
+        if (i >= size()) throw std::out_of_range("BasicScanStore::at");
+        return (*this)[i];
+    }
+    ScanView<T> front() const { return (*this)[0]; }
+    ScanView<T> back() const { return (*this)[size() - 1]; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    // The underlying buffers, e.g. for bulk processing over all scans.
+    const std::pmr::vector<T>& ranges() const { return ranges_; }
+    const std::pmr::vector<size_t>& offsets() const { return offsets_; }
+
+    void clear() {
+        ranges_.clear();
+        offsets_.assign(1, 0);
+    }
+
+    void reserve(size_t scans, size_t total_ranges) {
+        offsets_.reserve(scans + 1);
+        ranges_.reserve(total_ranges);
+    }
+
+    // Replaces all scans from raw CSR buffers: offsets has scans + 1
+    // entries starting at 0, ranges has offsets[scans] entries. Ranges of
+    // the same type are copied in bulk.
+    template <typename U, typename Offset>
+    void assign(const U* ranges, const Offset* offsets, size_t scans);
+
+    template <typename InputIt>
+    void emplace_back(InputIt first, InputIt last) {
+        begin_scan();
+        ranges_.insert(ranges_.end(), first, last);
+        end_scan();
+    }
+
+    template <typename U>
+    void push_back(const std::vector<U>& scan) { emplace_back(scan.begin(), scan.end()); }
+
+    template <typename U>
+    void push_back(const ScanView<U>& scan) { emplace_back(scan.begin(), scan.end()); }
+
+    // Appends all scans of another store.
+    void append(const BasicScanStore& other) {
+        size_t base = offsets_.back();
+        ranges_.resize(base);
+        ranges_.insert(ranges_.end(), other.ranges_.begin(), other.ranges_.begin() + other.offsets_.back());
+        offsets_.reserve(offsets_.size() + other.size());
+        for (size_t i = 1; i < other.offsets_.size(); ++i) offsets_.push_back(base + other.offsets_[i]);
+    }
+
+    // Builds a scan in place: begin_scan(), push_range() for every beam,
+    // then end_scan(). A scan that is never ended is dropped by the next
+    // begin_scan(), so a parse error cannot leave half a scan behind.
+    void begin_scan() { ranges_.resize(offsets_.back()); }
+    void push_range(T range) { ranges_.push_back(range); }
+    void end_scan() { offsets_.push_back(ranges_.size()); }
+
+    bool operator==(const BasicScanStore& other) const {
+        return offsets_ == other.offsets_ &&
+               std::equal(ranges_.begin(), ranges_.begin() + offsets_.back(), other.ranges_.begin());
+    }
+    bool operator!=(const BasicScanStore& other) const { return !(*this == other); }
+};
+
+using ScanStore = BasicScanStore<int>;
+
+// Ranges are in millimetres, so 16 bits cover 65 m, well beyond the
+// scanner. A compact store needs half the memory of a ScanStore and a
+// quarter of a copy widened to double.
+using CompactScanStore = BasicScanStore<std::uint16_t>;
+
+// Converts a range for a CompactScanStore. Negative values (never valid
+// measurements) become 0, values above 65535 are clamped.
+inline std::uint16_t compact_range(int range) {
+    if (range < 0) return 0;
+    if (range > 65535) return 65535;
+    return static_cast<std::uint16_t>(range);
+}
+
+template <typename T>
+template <typename U, typename Offset>
+void BasicScanStore<T>::assign(const U* ranges, const Offset* offsets, size_t scans) {
+    offsets_.assign(offsets, offsets + scans + 1);
+    size_t count = offsets_.back();
+    if constexpr (std::is_same_v<T, U>) {
+        ranges_.assign(ranges, ranges + count);
+    } else if constexpr (std::is_same_v<T, std::uint16_t>) {
+        ranges_.resize(count);
+        for (size_t i = 0; i < count; ++i) ranges_[i] = compact_range(static_cast<int>(ranges[i]));
+    } else {
+        ranges_.assign(ranges, ranges + count);
+    }
+}